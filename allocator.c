@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment){
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint32_t orderForSize(VkDeviceSize size){
+    uint32_t order = 0;
+    while((GPU_MIN_ALLOCATION << order) < size)
+        order++;
+    return order;
+}
+
+static bool isHostVisible(GpuAllocator *pAllocator, uint32_t memoryTypeIndex){
+    return pAllocator->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+// Wraps vkAllocateMemory so every device allocation is counted against the limit
+static VkResult allocateDeviceMemory(GpuAllocator *pAllocator, VkDeviceSize size, uint32_t memoryTypeIndex,
+    VkDeviceMemory *pMemory, void **pMapped){
+    if(pAllocator->stats.deviceAllocationCount >= pAllocator->maxAllocationCount)
+        return VK_ERROR_TOO_MANY_OBJECTS;
+
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memoryTypeIndex,
+    };
+
+    VkResult result = vkAllocateMemory(pAllocator->device, &allocInfo, NULL, pMemory);
+    if(result != VK_SUCCESS)
+        return result;
+
+    *pMapped = NULL;
+    if(isHostVisible(pAllocator, memoryTypeIndex)){
+        result = vkMapMemory(pAllocator->device, *pMemory, 0, VK_WHOLE_SIZE, 0, pMapped);
+        if(result != VK_SUCCESS){
+            vkFreeMemory(pAllocator->device, *pMemory, NULL);
+            return result;
+        }
+    }
+
+    pAllocator->stats.deviceAllocationCount++;
+    return VK_SUCCESS;
+}
+
+static void freeDeviceMemory(GpuAllocator *pAllocator, VkDeviceMemory memory){
+    vkFreeMemory(pAllocator->device, memory, NULL);
+    pAllocator->stats.deviceAllocationCount--;
+}
+
+void gpuAllocatorInit(GpuAllocator *pAllocator, VkPhysicalDevice physicalDevice, VkDevice device){
+    memset(pAllocator, 0, sizeof(GpuAllocator));
+    pAllocator->device = device;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &pAllocator->memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    pAllocator->bufferImageGranularity = properties.limits.bufferImageGranularity;
+    pAllocator->maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+}
+
+bool gpuFindMemoryType(GpuAllocator *pAllocator, uint32_t typeBits, VkMemoryPropertyFlags properties,
+    uint32_t *pIndex){
+    const VkPhysicalDeviceMemoryProperties *memProperties = &pAllocator->memoryProperties;
+
+    for(uint32_t i = 0; i < memProperties->memoryTypeCount; i++){
+        if((typeBits & (1u << i)) &&
+            (memProperties->memoryTypes[i].propertyFlags & properties) == properties){
+                *pIndex = i;
+                return true;
+            }
+    }
+    return false;
+}
+
+// Buddy allocator
+
+static void freeListPush(GpuFreeList *list, VkDeviceSize offset){
+    if(list->count == list->capacity){
+        list->capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+        list->offsets = (VkDeviceSize *) realloc(list->offsets, sizeof(VkDeviceSize) * list->capacity);
+    }
+    list->offsets[list->count++] = offset;
+}
+
+static bool freeListRemove(GpuFreeList *list, VkDeviceSize offset){
+    for(uint32_t i = 0; i < list->count; i++){
+        if(list->offsets[i] == offset){
+            list->offsets[i] = list->offsets[--list->count];
+            return true;
+        }
+    }
+    return false;
+}
+
+static VkResult createBlock(GpuAllocator *pAllocator, uint32_t memoryTypeIndex, GpuBlock **ppBlock){
+    GpuBlock *block = (GpuBlock *) calloc(1, sizeof(GpuBlock));
+    block->size = GPU_BLOCK_SIZE;
+    block->maxOrder = orderForSize(GPU_BLOCK_SIZE);
+
+    VkResult result = allocateDeviceMemory(pAllocator, block->size, memoryTypeIndex, &block->memory, &block->mapped);
+    if(result != VK_SUCCESS){
+        free(block);
+        return result;
+    }
+
+    freeListPush(&block->freeLists[block->maxOrder], 0);
+
+    block->next = pAllocator->blocks[memoryTypeIndex];
+    pAllocator->blocks[memoryTypeIndex] = block;
+    pAllocator->stats.blockCount++;
+    pAllocator->stats.blockBytes += block->size;
+
+    *ppBlock = block;
+    return VK_SUCCESS;
+}
+
+static void destroyBlock(GpuAllocator *pAllocator, GpuBlock *block){
+    for(uint32_t i = 0; i < GPU_MAX_ORDERS; i++)
+        free(block->freeLists[i].offsets);
+
+    freeDeviceMemory(pAllocator, block->memory);
+    pAllocator->stats.blockCount--;
+    pAllocator->stats.blockBytes -= block->size;
+    free(block);
+}
+
+// Takes the smallest free range of at least the given order and splits it down
+static bool blockAllocate(GpuBlock *block, uint32_t order, VkDeviceSize *pOffset){
+    uint32_t found = order;
+    while(found <= block->maxOrder && block->freeLists[found].count == 0)
+        found++;
+    if(found > block->maxOrder)
+        return false;
+
+    GpuFreeList *list = &block->freeLists[found];
+    VkDeviceSize offset = list->offsets[--list->count];
+
+    while(found > order){
+        found--;
+        freeListPush(&block->freeLists[found], offset + (GPU_MIN_ALLOCATION << found));
+    }
+
+    block->reservedBytes += GPU_MIN_ALLOCATION << order;
+    *pOffset = offset;
+    return true;
+}
+
+// Merges the range with its buddy for as long as the buddy is free
+static void blockFree(GpuBlock *block, VkDeviceSize offset, uint32_t order){
+    block->reservedBytes -= GPU_MIN_ALLOCATION << order;
+
+    while(order < block->maxOrder){
+        VkDeviceSize buddy = offset ^ (GPU_MIN_ALLOCATION << order);
+        if(!freeListRemove(&block->freeLists[order], buddy))
+            break;
+        if(buddy < offset)
+            offset = buddy;
+        order++;
+    }
+
+    freeListPush(&block->freeLists[order], offset);
+}
+
+static void trackAllocation(GpuAllocator *pAllocator, VkDeviceSize size){
+    GpuAllocatorStats *stats = &pAllocator->stats;
+
+    stats->allocationCount++;
+    stats->usedBytes += size;
+    if(stats->allocationCount > stats->peakAllocationCount)
+        stats->peakAllocationCount = stats->allocationCount;
+    if(stats->usedBytes > stats->peakUsedBytes)
+        stats->peakUsedBytes = stats->usedBytes;
+}
+
+VkResult gpuAllocate(GpuAllocator *pAllocator, const VkMemoryRequirements *pRequirements,
+    VkMemoryPropertyFlags properties, GpuAllocation *pAllocation){
+    uint32_t memoryTypeIndex;
+    if(!gpuFindMemoryType(pAllocator, pRequirements->memoryTypeBits, properties, &memoryTypeIndex))
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    memset(pAllocation, 0, sizeof(GpuAllocation));
+    pAllocation->size = pRequirements->size;
+    pAllocation->memoryTypeIndex = memoryTypeIndex;
+
+    if(pRequirements->size > GPU_BLOCK_SIZE / 2){
+        VkResult result = allocateDeviceMemory(pAllocator, pRequirements->size, memoryTypeIndex,
+            &pAllocation->memory, &pAllocation->mapped);
+        if(result != VK_SUCCESS)
+            return result;
+
+        pAllocation->dedicated = true;
+        pAllocator->stats.dedicatedCount++;
+        pAllocator->stats.dedicatedBytes += pRequirements->size;
+        trackAllocation(pAllocator, pRequirements->size);
+        return VK_SUCCESS;
+    }
+
+    // Buddy ranges are aligned to their own size, so rounding the size up to the
+    // alignment and buffer-image granularity keeps linear and optimal resources
+    // from sharing a granularity page.
+    VkDeviceSize size = pRequirements->size;
+    if(size < pRequirements->alignment)
+        size = pRequirements->alignment;
+    if(size < pAllocator->bufferImageGranularity)
+        size = pAllocator->bufferImageGranularity;
+    uint32_t order = orderForSize(size);
+
+    VkDeviceSize offset;
+    GpuBlock *block = pAllocator->blocks[memoryTypeIndex];
+    while(block != NULL && !blockAllocate(block, order, &offset))
+        block = block->next;
+
+    if(block == NULL){
+        VkResult result = createBlock(pAllocator, memoryTypeIndex, &block);
+        if(result != VK_SUCCESS)
+            return result;
+        blockAllocate(block, order, &offset);
+    }
+
+    pAllocation->memory = block->memory;
+    pAllocation->offset = offset;
+    pAllocation->mapped = block->mapped != NULL ? (char *) block->mapped + offset : NULL;
+    pAllocation->block = block;
+    pAllocation->order = order;
+
+    pAllocator->stats.reservedBytes += GPU_MIN_ALLOCATION << order;
+    trackAllocation(pAllocator, pRequirements->size);
+    return VK_SUCCESS;
+}
+
+void gpuFree(GpuAllocator *pAllocator, GpuAllocation *pAllocation){
+    if(pAllocation->memory == VK_NULL_HANDLE)
+        return;
+
+    // Linear allocations are released with their arena
+    GpuBlock *block = pAllocation->block;
+    if(block == NULL && !pAllocation->dedicated){
+        memset(pAllocation, 0, sizeof(GpuAllocation));
+        return;
+    }
+
+    if(block == NULL){
+        freeDeviceMemory(pAllocator, pAllocation->memory);
+        pAllocator->stats.dedicatedCount--;
+        pAllocator->stats.dedicatedBytes -= pAllocation->size;
+    }else{
+        blockFree(block, pAllocation->offset, pAllocation->order);
+        pAllocator->stats.reservedBytes -= GPU_MIN_ALLOCATION << pAllocation->order;
+
+        // Keep the first block of a memory type around to avoid reallocating it
+        // for every transient resource, release any other once it is empty.
+        GpuBlock **link = &pAllocator->blocks[pAllocation->memoryTypeIndex];
+        if(block->reservedBytes == 0 && *link != block){
+            while(*link != block)
+                link = &(*link)->next;
+            *link = block->next;
+            destroyBlock(pAllocator, block);
+        }
+    }
+
+    pAllocator->stats.allocationCount--;
+    pAllocator->stats.usedBytes -= pAllocation->size;
+    memset(pAllocation, 0, sizeof(GpuAllocation));
+}
+
+void gpuAllocatorDestroy(GpuAllocator *pAllocator){
+    if(pAllocator->stats.allocationCount != 0){
+        printf("gpu allocator destroyed with %u live allocations\n", pAllocator->stats.allocationCount);
+    }
+
+    for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++){
+        GpuBlock *block = pAllocator->blocks[i];
+        while(block != NULL){
+            GpuBlock *next = block->next;
+            destroyBlock(pAllocator, block);
+            block = next;
+        }
+        pAllocator->blocks[i] = NULL;
+    }
+}
+
+// Linear arenas
+
+VkResult gpuLinearArenaCreate(GpuAllocator *pAllocator, VkDeviceSize size, VkMemoryPropertyFlags properties,
+    GpuLinearArena *pArena){
+    memset(pArena, 0, sizeof(GpuLinearArena));
+
+    if(!gpuFindMemoryType(pAllocator, UINT32_MAX, properties, &pArena->memoryTypeIndex))
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    pArena->size = size;
+    return allocateDeviceMemory(pAllocator, size, pArena->memoryTypeIndex, &pArena->memory, &pArena->mapped);
+}
+
+void gpuLinearArenaDestroy(GpuAllocator *pAllocator, GpuLinearArena *pArena){
+    if(pArena->memory == VK_NULL_HANDLE)
+        return;
+
+    freeDeviceMemory(pAllocator, pArena->memory);
+    memset(pArena, 0, sizeof(GpuLinearArena));
+}
+
+// Fails when the arena is full or its memory type doesn't suit the resource,
+// the caller falls back to gpuAllocate.
+bool gpuLinearAllocate(GpuLinearArena *pArena, const VkMemoryRequirements *pRequirements,
+    GpuAllocation *pAllocation){
+    if(!(pRequirements->memoryTypeBits & (1u << pArena->memoryTypeIndex)))
+        return false;
+
+    VkDeviceSize offset = alignUp(pArena->head, pRequirements->alignment);
+    if(offset + pRequirements->size > pArena->size)
+        return false;
+
+    pArena->head = offset + pRequirements->size;
+    if(pArena->head > pArena->peak)
+        pArena->peak = pArena->head;
+
+    *pAllocation = (GpuAllocation) {
+        .memory = pArena->memory,
+        .offset = offset,
+        .size = pRequirements->size,
+        .mapped = pArena->mapped != NULL ? (char *) pArena->mapped + offset : NULL,
+        .memoryTypeIndex = pArena->memoryTypeIndex,
+    };
+    return true;
+}
+
+// Only once every resource placed in the arena is no longer used by the GPU
+void gpuLinearReset(GpuLinearArena *pArena){
+    pArena->head = 0;
+}
+
+// Stats
+
+// External fragmentation: how much of the free space is unusable for a
+// request as large as the total free space, 0 when it is all one range.
+static double blockFragmentation(GpuAllocator *pAllocator, VkDeviceSize *pFreeBytes){
+    VkDeviceSize freeBytes = 0;
+    VkDeviceSize largestFree = 0;
+
+    for(uint32_t t = 0; t < VK_MAX_MEMORY_TYPES; t++){
+        for(GpuBlock *block = pAllocator->blocks[t]; block != NULL; block = block->next){
+            for(uint32_t order = 0; order <= block->maxOrder; order++){
+                VkDeviceSize rangeSize = GPU_MIN_ALLOCATION << order;
+                freeBytes += rangeSize * block->freeLists[order].count;
+                if(block->freeLists[order].count > 0 && rangeSize > largestFree)
+                    largestFree = rangeSize;
+            }
+        }
+    }
+
+    *pFreeBytes = freeBytes;
+    return freeBytes == 0 ? 0.0 : 1.0 - (double) largestFree / freeBytes;
+}
+
+void gpuAllocatorWriteStats(GpuAllocator *pAllocator, FILE *file){
+    GpuAllocatorStats *stats = &pAllocator->stats;
+    const double mib = 1024.0 * 1024.0;
+
+    VkDeviceSize freeBytes;
+    double fragmentation = blockFragmentation(pAllocator, &freeBytes);
+    VkDeviceSize pooledBytes = stats->usedBytes - stats->dedicatedBytes;
+    double internalWaste = stats->reservedBytes == 0 ? 0.0 :
+        1.0 - (double) pooledBytes / stats->reservedBytes;
+
+    fprintf(file, "gpu memory: %u device allocations (limit %u), %u blocks %.1f MiB, %u dedicated %.1f MiB\n",
+        stats->deviceAllocationCount, pAllocator->maxAllocationCount,
+        stats->blockCount, stats->blockBytes / mib, stats->dedicatedCount, stats->dedicatedBytes / mib);
+    fprintf(file, "gpu memory: %u allocations (peak %u), used %.3f MiB (peak %.3f MiB), "
+        "free in blocks %.1f MiB, internal waste %.1f%%, external fragmentation %.1f%%\n",
+        stats->allocationCount, stats->peakAllocationCount, stats->usedBytes / mib, stats->peakUsedBytes / mib,
+        freeBytes / mib, internalWaste * 100.0, fragmentation * 100.0);
+}
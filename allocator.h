@@ -0,0 +1,103 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+/* Device memory sub-allocator.
+ * Long-lived resources are carved out of GPU_BLOCK_SIZE blocks with a buddy
+ * allocator, one list of blocks per memory type. Requests larger than half a
+ * block get a dedicated vkAllocateMemory. Short-lived data goes through
+ * GpuLinearArena, a bump allocator over a single allocation that is reset as
+ * a whole once the GPU is done with it. Host visible memory stays mapped. */
+
+#define GPU_BLOCK_SIZE ((VkDeviceSize) 64 << 20)
+#define GPU_MIN_ALLOCATION ((VkDeviceSize) 256)
+#define GPU_MAX_ORDERS 32
+
+typedef struct GpuFreeList {
+    VkDeviceSize *offsets;
+    uint32_t count;
+    uint32_t capacity;
+} GpuFreeList;
+
+typedef struct GpuBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t maxOrder; // size == GPU_MIN_ALLOCATION << maxOrder
+    void *mapped;
+    GpuFreeList freeLists[GPU_MAX_ORDERS]; // free offsets by order
+    VkDeviceSize reservedBytes;
+    struct GpuBlock *next;
+} GpuBlock;
+
+typedef struct GpuAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;   // as requested
+    void *mapped;        // NULL unless host visible
+    GpuBlock *block;     // NULL for dedicated and linear allocations
+    uint32_t order;
+    uint32_t memoryTypeIndex;
+    bool dedicated;
+} GpuAllocation;
+
+typedef struct GpuLinearArena {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize head;
+    VkDeviceSize peak;
+    uint32_t memoryTypeIndex;
+    void *mapped;
+} GpuLinearArena;
+
+typedef struct GpuAllocatorStats {
+    uint32_t deviceAllocationCount; // live vkAllocateMemory calls
+    uint32_t blockCount;
+    uint32_t dedicatedCount;
+    uint32_t allocationCount;
+    uint32_t peakAllocationCount;
+    VkDeviceSize blockBytes;
+    VkDeviceSize dedicatedBytes;
+    VkDeviceSize usedBytes;     // requested sizes
+    VkDeviceSize reservedBytes; // power of two sizes carved from blocks
+    VkDeviceSize peakUsedBytes;
+} GpuAllocatorStats;
+
+typedef struct GpuAllocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize bufferImageGranularity;
+    uint32_t maxAllocationCount;
+    GpuBlock *blocks[VK_MAX_MEMORY_TYPES];
+    GpuAllocatorStats stats;
+} GpuAllocator;
+
+void gpuAllocatorInit(GpuAllocator *pAllocator, VkPhysicalDevice physicalDevice, VkDevice device);
+
+void gpuAllocatorDestroy(GpuAllocator *pAllocator);
+
+bool gpuFindMemoryType(GpuAllocator *pAllocator, uint32_t typeBits, VkMemoryPropertyFlags properties,
+    uint32_t *pIndex);
+
+VkResult gpuAllocate(GpuAllocator *pAllocator, const VkMemoryRequirements *pRequirements,
+    VkMemoryPropertyFlags properties, GpuAllocation *pAllocation);
+
+void gpuFree(GpuAllocator *pAllocator, GpuAllocation *pAllocation);
+
+VkResult gpuLinearArenaCreate(GpuAllocator *pAllocator, VkDeviceSize size, VkMemoryPropertyFlags properties,
+    GpuLinearArena *pArena);
+
+void gpuLinearArenaDestroy(GpuAllocator *pAllocator, GpuLinearArena *pArena);
+
+bool gpuLinearAllocate(GpuLinearArena *pArena, const VkMemoryRequirements *pRequirements,
+    GpuAllocation *pAllocation);
+
+void gpuLinearReset(GpuLinearArena *pArena);
+
+void gpuAllocatorWriteStats(GpuAllocator *pAllocator, FILE *file);
+
+#endif
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bindless.h"
+
+// Every binding is written while the set may be bound, and only slots in use are valid
+#define BINDLESS_BINDING_FLAGS (VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | \
+    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT)
+
+static void initSlots(BindlessSlots *pSlots, uint32_t capacity){
+    *pSlots = (BindlessSlots) {
+        .capacity = capacity,
+        .freeSlots = (uint32_t *) malloc(sizeof(uint32_t) * (capacity > 0 ? capacity : 1)),
+    };
+}
+
+static uint32_t takeSlot(BindlessSlots *pSlots){
+    if(pSlots->freeCount > 0)
+        return pSlots->freeSlots[--pSlots->freeCount];
+    if(pSlots->count == pSlots->capacity)
+        return BINDLESS_INVALID_SLOT;
+    return pSlots->count++;
+}
+
+static void returnSlot(BindlessSlots *pSlots, uint32_t slot){
+    if(slot < pSlots->count && pSlots->freeCount < pSlots->capacity)
+        pSlots->freeSlots[pSlots->freeCount++] = slot;
+}
+
+VkResult bindlessHeapCreate(BindlessHeap *pHeap, VkDevice device, uint32_t bufferCapacity, uint32_t imageCapacity,
+    VkShaderStageFlags stages){
+    memset(pHeap, 0, sizeof(BindlessHeap));
+    pHeap->device = device;
+
+    // Zero sized bindings are allowed but can't be written, keep one slot each
+    bufferCapacity = bufferCapacity > 0 ? bufferCapacity : 1;
+    imageCapacity = imageCapacity > 0 ? imageCapacity : 1;
+
+    VkDescriptorSetLayoutBinding bindings[] = {
+        {
+            .binding = BINDLESS_BUFFER_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = bufferCapacity,
+            .stageFlags = stages,
+        },
+        {
+            .binding = BINDLESS_IMAGE_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = imageCapacity,
+            .stageFlags = stages,
+        },
+    };
+    VkDescriptorBindingFlags bindingFlags[] = {BINDLESS_BINDING_FLAGS, BINDLESS_BINDING_FLAGS};
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindingFlags = bindingFlags,
+    };
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &bindingFlagsInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 2,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &pHeap->layout);
+    if(result != VK_SUCCESS)
+        return result;
+
+    VkDescriptorPoolSize poolSizes[] = {
+        {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = bufferCapacity},
+        {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = imageCapacity},
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 2,
+        .pPoolSizes = poolSizes,
+    };
+
+    result = vkCreateDescriptorPool(device, &poolInfo, NULL, &pHeap->pool);
+    if(result != VK_SUCCESS)
+        return result;
+
+    VkDescriptorSetAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = pHeap->pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &pHeap->layout,
+    };
+
+    result = vkAllocateDescriptorSets(device, &allocInfo, &pHeap->set);
+    if(result != VK_SUCCESS)
+        return result;
+
+    initSlots(&pHeap->buffers, bufferCapacity);
+    initSlots(&pHeap->images, imageCapacity);
+    return VK_SUCCESS;
+}
+
+void bindlessHeapDestroy(BindlessHeap *pHeap){
+    vkDestroyDescriptorPool(pHeap->device, pHeap->pool, NULL); // frees the set
+    vkDestroyDescriptorSetLayout(pHeap->device, pHeap->layout, NULL);
+    free(pHeap->buffers.freeSlots);
+    free(pHeap->images.freeSlots);
+    memset(pHeap, 0, sizeof(BindlessHeap));
+}
+
+void bindlessSetBuffer(BindlessHeap *pHeap, uint32_t slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range){
+    VkDescriptorBufferInfo bufferInfo = {
+        .buffer = buffer,
+        .offset = offset,
+        .range = range,
+    };
+
+    VkWriteDescriptorSet descriptorWrite = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pHeap->set,
+        .dstBinding = BINDLESS_BUFFER_BINDING,
+        .dstArrayElement = slot,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .pBufferInfo = &bufferInfo,
+    };
+
+    vkUpdateDescriptorSets(pHeap->device, 1, &descriptorWrite, 0, NULL);
+}
+
+uint32_t bindlessAddBuffer(BindlessHeap *pHeap, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range){
+    uint32_t slot = takeSlot(&pHeap->buffers);
+    if(slot != BINDLESS_INVALID_SLOT)
+        bindlessSetBuffer(pHeap, slot, buffer, offset, range);
+    return slot;
+}
+
+void bindlessSetImage(BindlessHeap *pHeap, uint32_t slot, VkImageView view, VkSampler sampler, VkImageLayout layout){
+    VkDescriptorImageInfo imageInfo = {
+        .sampler = sampler,
+        .imageView = view,
+        .imageLayout = layout,
+    };
+
+    VkWriteDescriptorSet descriptorWrite = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pHeap->set,
+        .dstBinding = BINDLESS_IMAGE_BINDING,
+        .dstArrayElement = slot,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .pImageInfo = &imageInfo,
+    };
+
+    vkUpdateDescriptorSets(pHeap->device, 1, &descriptorWrite, 0, NULL);
+}
+
+uint32_t bindlessAddImage(BindlessHeap *pHeap, VkImageView view, VkSampler sampler, VkImageLayout layout){
+    uint32_t slot = takeSlot(&pHeap->images);
+    if(slot != BINDLESS_INVALID_SLOT)
+        bindlessSetImage(pHeap, slot, view, sampler, layout);
+    return slot;
+}
+
+void bindlessRemoveBuffer(BindlessHeap *pHeap, uint32_t slot){
+    returnSlot(&pHeap->buffers, slot);
+}
+
+void bindlessRemoveImage(BindlessHeap *pHeap, uint32_t slot){
+    returnSlot(&pHeap->images, slot);
+}
+
+void bindlessHeapWriteStats(BindlessHeap *pHeap, FILE *file){
+    fprintf(file, "bindless heap: %u/%u buffers, %u/%u images\n",
+        pHeap->buffers.count - pHeap->buffers.freeCount, pHeap->buffers.capacity,
+        pHeap->images.count - pHeap->images.freeCount, pHeap->images.capacity);
+}
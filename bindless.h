@@ -0,0 +1,62 @@
+#ifndef BINDLESS_H
+#define BINDLESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+/* Bindless descriptor heap.
+ * A single descriptor set holds one array of storage buffers and one array of
+ * combined image samplers, created with update-after-bind and partially bound
+ * bindings. The set is bound once per command buffer and shaders pick their
+ * resources by slot index, passed in push constants, so the number of binds
+ * doesn't grow with the scene. Slots can be written while command buffers that
+ * bind the set are recorded or pending, as long as the device doesn't read the
+ * slot being replaced. */
+
+#define BINDLESS_BUFFER_BINDING 0
+#define BINDLESS_IMAGE_BINDING 1
+#define BINDLESS_INVALID_SLOT UINT32_MAX
+
+typedef struct BindlessSlots {
+    uint32_t capacity;
+    uint32_t count;      // slots handed out so far, free ones are reused first
+    uint32_t *freeSlots;
+    uint32_t freeCount;
+} BindlessSlots;
+
+typedef struct BindlessHeap {
+    VkDevice device;
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+
+    BindlessSlots buffers;
+    BindlessSlots images;
+} BindlessHeap;
+
+VkResult bindlessHeapCreate(BindlessHeap *pHeap, VkDevice device, uint32_t bufferCapacity, uint32_t imageCapacity,
+    VkShaderStageFlags stages);
+
+// The device must be done with every command buffer that binds the set
+void bindlessHeapDestroy(BindlessHeap *pHeap);
+
+// Returns BINDLESS_INVALID_SLOT once the array is full
+uint32_t bindlessAddBuffer(BindlessHeap *pHeap, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+
+void bindlessSetBuffer(BindlessHeap *pHeap, uint32_t slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+
+uint32_t bindlessAddImage(BindlessHeap *pHeap, VkImageView view, VkSampler sampler, VkImageLayout layout);
+
+void bindlessSetImage(BindlessHeap *pHeap, uint32_t slot, VkImageView view, VkSampler sampler, VkImageLayout layout);
+
+// The slot keeps its descriptor until it is handed out again
+void bindlessRemoveBuffer(BindlessHeap *pHeap, uint32_t slot);
+
+void bindlessRemoveImage(BindlessHeap *pHeap, uint32_t slot);
+
+void bindlessHeapWriteStats(BindlessHeap *pHeap, FILE *file);
+
+#endif
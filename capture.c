@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "capture.h"
+#include "stats.h"
+
+static void writePpm(FrameCapture *pCapture, const CaptureSlot *pSlot){
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/frame_%06llu.ppm", pCapture->directory,
+        (unsigned long long) pSlot->frame);
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        printf("failed to open capture file %s\n", path);
+        return;
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", pSlot->width, pSlot->height);
+
+    const uint8_t *pixels = (const uint8_t *) pSlot->allocation.mapped;
+    uint8_t *row = (uint8_t *) malloc((size_t) pSlot->width * 3);
+    uint32_t red = pSlot->bgra ? 2 : 0;
+    uint32_t blue = pSlot->bgra ? 0 : 2;
+
+    for(uint32_t y = 0; y < pSlot->height; y++){
+        const uint8_t *src = pixels + (size_t) y * pSlot->width * 4;
+        for(uint32_t x = 0; x < pSlot->width; x++){
+            row[x * 3 + 0] = src[x * 4 + red];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + blue];
+        }
+        fwrite(row, 3, pSlot->width, file);
+    }
+
+    free(row);
+    fclose(file);
+}
+
+static void *captureWriterMain(void *pArg){
+    FrameCapture *pCapture = (FrameCapture *) pArg;
+
+    pthread_mutex_lock(&pCapture->mutex);
+    for(;;){
+        while(pCapture->pending == 0 && !pCapture->quit)
+            pthread_cond_wait(&pCapture->changed, &pCapture->mutex);
+        if(pCapture->pending == 0)
+            break;
+
+        CaptureSlot *slot = &pCapture->slots[pCapture->writeNext];
+        pthread_mutex_unlock(&pCapture->mutex);
+
+        VkSemaphoreWaitInfo waitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &pCapture->timeline,
+            .pValues = &slot->timelineValue,
+        };
+        vkWaitSemaphores(pCapture->device, &waitInfo, UINT64_MAX);
+
+        double start = getTimeMs();
+        writePpm(pCapture, slot);
+        double elapsed = getTimeMs() - start;
+
+        pthread_mutex_lock(&pCapture->mutex);
+        slot->busy = false;
+        pCapture->writeNext = (pCapture->writeNext + 1) % CAPTURE_RING_SIZE;
+        pCapture->pending--;
+        pCapture->written++;
+        pCapture->writeMs += elapsed;
+    }
+    pthread_mutex_unlock(&pCapture->mutex);
+
+    return NULL;
+}
+
+void frameCaptureStart(FrameCapture *pCapture, VkDevice device, VkSemaphore timeline, const char *directory){
+    pCapture->device = device;
+    pCapture->timeline = timeline;
+    pCapture->directory = directory;
+
+    pthread_mutex_init(&pCapture->mutex, NULL);
+    pthread_cond_init(&pCapture->changed, NULL);
+
+    if(pthread_create(&pCapture->thread, NULL, captureWriterMain, pCapture) != 0){
+        printf("failed to start capture writer thread!\n");
+        exit(1);
+    }
+    pCapture->active = true;
+}
+
+CaptureSlot *frameCaptureAcquire(FrameCapture *pCapture){
+    CaptureSlot *slot = &pCapture->slots[pCapture->submitNext];
+
+    pthread_mutex_lock(&pCapture->mutex);
+    bool busy = slot->busy;
+    if(busy)
+        pCapture->dropped++;
+    pthread_mutex_unlock(&pCapture->mutex);
+
+    return busy ? NULL : slot;
+}
+
+void frameCaptureSubmit(FrameCapture *pCapture, CaptureSlot *pSlot){
+    pthread_mutex_lock(&pCapture->mutex);
+    pSlot->busy = true;
+    pCapture->submitNext = (pCapture->submitNext + 1) % CAPTURE_RING_SIZE;
+    pCapture->pending++;
+    pthread_cond_signal(&pCapture->changed);
+    pthread_mutex_unlock(&pCapture->mutex);
+}
+
+void frameCaptureStop(FrameCapture *pCapture){
+    pthread_mutex_lock(&pCapture->mutex);
+    pCapture->quit = true;
+    pthread_cond_signal(&pCapture->changed);
+    pthread_mutex_unlock(&pCapture->mutex);
+
+    pthread_join(pCapture->thread, NULL);
+
+    pthread_mutex_destroy(&pCapture->mutex);
+    pthread_cond_destroy(&pCapture->changed);
+    pCapture->active = false;
+}
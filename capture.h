@@ -0,0 +1,68 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.h"
+
+/* Frame capture to disk.
+ * Rendered frames are copied into a ring of host visible readback buffers. A
+ * writer thread waits on the frame timeline for each filled slot and writes it
+ * out as a binary PPM. The render loop never waits on the copy or on disk I/O:
+ * when every slot is still busy, the frame is dropped instead. */
+
+#define CAPTURE_RING_SIZE 4
+
+typedef struct CaptureSlot {
+    VkBuffer buffer;
+    GpuAllocation allocation; // persistently mapped
+    VkDeviceSize capacity;
+    VkCommandBuffer commandBuffer;
+
+    // Filled in before frameCaptureSubmit, read by the writer
+    uint64_t timelineValue; // the copy is done once the timeline reaches it
+    uint64_t frame;
+    uint32_t width;
+    uint32_t height;
+    bool bgra; // swizzled to RGB by the writer
+
+    bool busy; // owned by the GPU or the writer, guarded by FrameCapture.mutex
+} CaptureSlot;
+
+typedef struct FrameCapture {
+    VkDevice device;
+    VkSemaphore timeline;
+    const char *directory;
+
+    CaptureSlot slots[CAPTURE_RING_SIZE];
+    uint32_t submitNext; // slots are submitted and written in ring order
+    uint32_t writeNext;
+    uint32_t pending;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    bool quit;
+    bool active; // between frameCaptureStart and frameCaptureStop
+
+    uint64_t written;
+    uint64_t dropped;
+    double writeMs; // total time the writer spent encoding and writing
+} FrameCapture;
+
+void frameCaptureStart(FrameCapture *pCapture, VkDevice device, VkSemaphore timeline, const char *directory);
+
+// Next free slot, or NULL (and the frame counts as dropped) while the writer is behind
+CaptureSlot *frameCaptureAcquire(FrameCapture *pCapture);
+
+// Hands a slot whose copy was just submitted to the writer
+void frameCaptureSubmit(FrameCapture *pCapture, CaptureSlot *pSlot);
+
+// Writes out every submitted slot, then stops the writer
+void frameCaptureStop(FrameCapture *pCapture);
+
+#endif
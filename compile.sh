@@ -1,2 +1,3 @@
 /usr/bin/glslc shaders/shader.vert -o shaders/vert.spv
-/usr/bin/glslc shaders/shader.frag -o shaders/frag.spv
\ No newline at end of file
+/usr/bin/glslc shaders/shader.frag -o shaders/frag.spv
+/usr/bin/glslc shaders/shader.comp -o shaders/comp.spv
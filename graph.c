@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graph.h"
+
+// Synchronization state of one image between its uses
+typedef struct GraphImageState {
+    VkImageLayout layout;
+    VkPipelineStageFlags2KHR writeStages; // last write, or the layout transition
+    VkAccessFlags2KHR writeAccess;
+    VkPipelineStageFlags2KHR readStages; // reads since the last write
+    VkPipelineStageFlags2KHR visibleStages; // already ordered after the last write
+    VkAccessFlags2KHR visibleAccess;
+} GraphImageState;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment){
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void renderGraphInit(RenderGraph *pGraph, VkDevice device, GpuAllocator *pAllocator,
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2){
+    memset(pGraph, 0, sizeof(RenderGraph));
+    pGraph->device = device;
+    pGraph->pAllocator = pAllocator;
+    pGraph->cmdPipelineBarrier2 = cmdPipelineBarrier2;
+}
+
+static GraphResource *addResource(RenderGraph *pGraph, const char *name, VkImageAspectFlags aspect){
+    if(pGraph->compiled || pGraph->resourceCount == RENDER_GRAPH_MAX_RESOURCES){
+        printf("render graph: can't add resource %s\n", name);
+        exit(1);
+    }
+
+    GraphResource *resource = &pGraph->resources[pGraph->resourceCount++];
+    *resource = (GraphResource) {
+        .name = name,
+        .aspect = aspect,
+        .firstPass = RENDER_GRAPH_MAX_PASSES,
+    };
+    return resource;
+}
+
+RenderGraphResource renderGraphImportImage(RenderGraph *pGraph, const char *name, VkImageAspectFlags aspect,
+    VkImageLayout initialLayout, VkPipelineStageFlags2KHR initialStages,
+    VkImageLayout finalLayout, VkPipelineStageFlags2KHR finalStages){
+    GraphResource *resource = addResource(pGraph, name, aspect);
+    resource->imported = true;
+    resource->initialLayout = initialLayout;
+    resource->initialStages = initialStages;
+    resource->finalLayout = finalLayout;
+    resource->finalStages = finalStages;
+    return pGraph->resourceCount - 1;
+}
+
+RenderGraphResource renderGraphCreateImage(RenderGraph *pGraph, const char *name, VkImageAspectFlags aspect,
+    const VkImageCreateInfo *pCreateInfo){
+    GraphResource *resource = addResource(pGraph, name, aspect);
+    resource->createInfo = *pCreateInfo;
+    resource->createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    return pGraph->resourceCount - 1;
+}
+
+uint32_t renderGraphAddPass(RenderGraph *pGraph, const char *name, bool sideEffects,
+    RenderGraphRecord record, void *pContext){
+    if(pGraph->compiled || pGraph->passCount == RENDER_GRAPH_MAX_PASSES){
+        printf("render graph: can't add pass %s\n", name);
+        exit(1);
+    }
+
+    pGraph->passes[pGraph->passCount] = (GraphPass) {
+        .name = name,
+        .sideEffects = sideEffects,
+        .record = record,
+        .pContext = pContext,
+    };
+    return pGraph->passCount++;
+}
+
+static void addAccess(RenderGraph *pGraph, uint32_t pass, RenderGraphResource resource,
+    VkPipelineStageFlags2KHR stages, VkAccessFlags2KHR access, VkImageLayout layout, bool write){
+    GraphPass *graphPass = &pGraph->passes[pass];
+    if(pGraph->compiled || graphPass->accessCount == RENDER_GRAPH_MAX_ACCESSES){
+        printf("render graph: can't add access to %s in pass %s\n", pGraph->resources[resource].name,
+            graphPass->name);
+        exit(1);
+    }
+
+    graphPass->accesses[graphPass->accessCount++] = (GraphAccess) {
+        .resource = resource,
+        .stages = stages,
+        .access = access,
+        .layout = layout,
+        .write = write,
+    };
+}
+
+void renderGraphRead(RenderGraph *pGraph, uint32_t pass, RenderGraphResource resource,
+    VkPipelineStageFlags2KHR stages, VkAccessFlags2KHR access, VkImageLayout layout){
+    addAccess(pGraph, pass, resource, stages, access, layout, false);
+}
+
+void renderGraphWrite(RenderGraph *pGraph, uint32_t pass, RenderGraphResource resource,
+    VkPipelineStageFlags2KHR stages, VkAccessFlags2KHR access, VkImageLayout layout){
+    addAccess(pGraph, pass, resource, stages, access, layout, true);
+}
+
+// Walks back from the imported images: a pass stays when it has side effects
+// or writes something a later surviving pass reads
+static void cullPasses(RenderGraph *pGraph){
+    bool needed[RENDER_GRAPH_MAX_RESOURCES];
+    for(uint32_t r = 0; r < pGraph->resourceCount; r++)
+        needed[r] = pGraph->resources[r].imported;
+
+    for(uint32_t p = pGraph->passCount; p-- > 0;){
+        GraphPass *pass = &pGraph->passes[p];
+        bool live = pass->sideEffects;
+        for(uint32_t a = 0; a < pass->accessCount; a++){
+            if(pass->accesses[a].write && needed[pass->accesses[a].resource])
+                live = true;
+        }
+
+        pass->culled = !live;
+        if(!live){
+            pGraph->culledCount++;
+            continue;
+        }
+        for(uint32_t a = 0; a < pass->accessCount; a++){
+            if(!pass->accesses[a].write)
+                needed[pass->accesses[a].resource] = true;
+        }
+    }
+
+    for(uint32_t p = 0; p < pGraph->passCount; p++){
+        GraphPass *pass = &pGraph->passes[p];
+        for(uint32_t a = 0; !pass->culled && a < pass->accessCount; a++){
+            GraphResource *resource = &pGraph->resources[pass->accesses[a].resource];
+            if(resource->firstPass == RENDER_GRAPH_MAX_PASSES)
+                resource->firstPass = p;
+            resource->lastPass = p;
+        }
+    }
+}
+
+static bool lifetimesOverlap(const GraphResource *a, const GraphResource *b){
+    return a->firstPass <= b->lastPass && b->firstPass <= a->lastPass;
+}
+
+static bool memoryOverlaps(const GraphResource *a, const GraphResource *b){
+    return a->offset < b->offset + b->memoryRequirements.size &&
+        b->offset < a->offset + a->memoryRequirements.size;
+}
+
+static bool isTransient(const GraphResource *resource){
+    return !resource->imported && resource->firstPass != RENDER_GRAPH_MAX_PASSES;
+}
+
+// Largest first, each at the lowest offset clear of every transient that is
+// alive at the same time. Transients that never overlap share memory.
+static VkResult allocateTransients(RenderGraph *pGraph){
+    GraphResource *order[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t count = 0;
+    VkMemoryRequirements heap = {.memoryTypeBits = ~0u, .alignment = 1};
+
+    for(uint32_t r = 0; r < pGraph->resourceCount; r++){
+        GraphResource *resource = &pGraph->resources[r];
+        if(!isTransient(resource))
+            continue;
+
+        VkResult result = vkCreateImage(pGraph->device, &resource->createInfo, NULL, &resource->image);
+        if(result != VK_SUCCESS)
+            return result;
+        vkGetImageMemoryRequirements(pGraph->device, resource->image, &resource->memoryRequirements);
+
+        const VkMemoryRequirements *requirements = &resource->memoryRequirements;
+        heap.memoryTypeBits &= requirements->memoryTypeBits;
+        if(requirements->alignment > heap.alignment)
+            heap.alignment = requirements->alignment;
+        pGraph->unaliasedBytes = alignUp(pGraph->unaliasedBytes, requirements->alignment) + requirements->size;
+
+        uint32_t i = count++;
+        while(i > 0 && order[i - 1]->memoryRequirements.size < requirements->size){
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = resource;
+    }
+
+    if(count == 0)
+        return VK_SUCCESS;
+    if(heap.memoryTypeBits == 0)
+        return VK_ERROR_FEATURE_NOT_PRESENT; // no memory type fits every transient
+
+    for(uint32_t i = 0; i < count; i++){
+        GraphResource *resource = order[i];
+        VkDeviceSize alignment = resource->memoryRequirements.alignment;
+
+        // Candidates are 0 and the end of every placed neighbour in time, lowest fit wins
+        VkDeviceSize best = UINT64_MAX;
+        for(uint32_t c = 0; c <= i; c++){
+            VkDeviceSize candidate = c == i ? 0 :
+                alignUp(order[c]->offset + order[c]->memoryRequirements.size, alignment);
+            if(c < i && !lifetimesOverlap(order[c], resource))
+                continue;
+            if(candidate >= best)
+                continue;
+
+            resource->offset = candidate;
+            bool fits = true;
+            for(uint32_t p = 0; p < i && fits; p++){
+                if(lifetimesOverlap(order[p], resource) && memoryOverlaps(order[p], resource))
+                    fits = false;
+            }
+            if(fits)
+                best = candidate;
+        }
+        resource->offset = best;
+
+        if(best + resource->memoryRequirements.size > heap.size)
+            heap.size = best + resource->memoryRequirements.size;
+    }
+    pGraph->transientBytes = heap.size;
+
+    VkResult result = gpuAllocate(pGraph->pAllocator, &heap, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        &pGraph->transientAllocation);
+    if(result != VK_SUCCESS)
+        return result;
+
+    for(uint32_t i = 0; i < count; i++){
+        GraphResource *resource = order[i];
+        result = vkBindImageMemory(pGraph->device, resource->image, pGraph->transientAllocation.memory,
+            pGraph->transientAllocation.offset + resource->offset);
+        if(result != VK_SUCCESS)
+            return result;
+
+        VkImageViewCreateInfo viewInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = resource->image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = resource->createInfo.format,
+            .subresourceRange = {
+                .aspectMask = resource->aspect,
+                .baseMipLevel = 0,
+                .levelCount = VK_REMAINING_MIP_LEVELS,
+                .baseArrayLayer = 0,
+                .layerCount = VK_REMAINING_ARRAY_LAYERS,
+            },
+        };
+        result = vkCreateImageView(pGraph->device, &viewInfo, NULL, &resource->view);
+        if(result != VK_SUCCESS)
+            return result;
+    }
+    return VK_SUCCESS;
+}
+
+// Barrier for one use given the image's state so far, false when none is needed.
+// A layout change or a write waits on everything since the last write; a read
+// only waits when the last write isn't visible to its stages yet.
+static bool placeBarrier(GraphImageState *state, const GraphAccess *access, GraphBarrier *pBarrier){
+    *pBarrier = (GraphBarrier) {
+        .resource = access->resource,
+        .dstStages = access->stages,
+        .dstAccess = access->access,
+        .oldLayout = state->layout,
+        .newLayout = access->layout,
+    };
+
+    if(state->layout != access->layout || access->write){
+        pBarrier->srcStages = state->writeStages | state->readStages;
+        pBarrier->srcAccess = state->writeAccess;
+        bool needed = state->layout != access->layout || pBarrier->srcStages != 0;
+
+        // A layout transition counts as a write at the stages it was ordered before
+        state->layout = access->layout;
+        state->writeStages = access->stages;
+        state->writeAccess = access->write ? access->access : 0;
+        state->readStages = access->write ? 0 : access->stages;
+        state->visibleStages = access->write ? 0 : access->stages;
+        state->visibleAccess = access->write ? 0 : access->access;
+        return needed;
+    }
+
+    bool needed = state->writeStages != 0 &&
+        ((access->stages & ~state->visibleStages) || (access->access & ~state->visibleAccess));
+    if(needed){
+        pBarrier->srcStages = state->writeStages;
+        pBarrier->srcAccess = state->writeAccess;
+        state->visibleStages |= access->stages;
+        state->visibleAccess |= access->access;
+    }
+    state->readStages |= access->stages;
+    return needed;
+}
+
+static void placeBarriers(RenderGraph *pGraph){
+    GraphImageState states[RENDER_GRAPH_MAX_RESOURCES];
+    bool used[RENDER_GRAPH_MAX_RESOURCES] = {0};
+    for(uint32_t r = 0; r < pGraph->resourceCount; r++){
+        GraphResource *resource = &pGraph->resources[r];
+        states[r] = (GraphImageState) {
+            .layout = resource->imported ? resource->initialLayout : VK_IMAGE_LAYOUT_UNDEFINED,
+            .writeStages = resource->imported ? resource->initialStages : 0,
+        };
+    }
+
+    for(uint32_t p = 0; p < pGraph->passCount; p++){
+        GraphPass *pass = &pGraph->passes[p];
+        if(pass->culled)
+            continue;
+
+        for(uint32_t a = 0; a < pass->accessCount; a++){
+            RenderGraphResource r = pass->accesses[a].resource;
+            GraphResource *resource = &pGraph->resources[r];
+
+            // First use of an aliased transient waits for the earlier images in its memory
+            if(isTransient(resource) && !used[r]){
+                for(uint32_t q = 0; q < pGraph->resourceCount; q++){
+                    GraphResource *earlier = &pGraph->resources[q];
+                    if(q == r || !isTransient(earlier) || earlier->lastPass >= p || !memoryOverlaps(earlier, resource))
+                        continue;
+                    states[r].writeStages |= states[q].writeStages | states[q].readStages;
+                    states[r].writeAccess |= states[q].writeAccess;
+                }
+            }
+            used[r] = true;
+
+            if(placeBarrier(&states[r], &pass->accesses[a], &pass->barriers[pass->barrierCount]))
+                pass->barrierCount++;
+        }
+        pGraph->barrierCount += pass->barrierCount;
+    }
+
+    for(uint32_t r = 0; r < pGraph->resourceCount; r++){
+        GraphResource *resource = &pGraph->resources[r];
+        if(!resource->imported || states[r].layout == resource->finalLayout)
+            continue;
+
+        pGraph->finalBarriers[pGraph->finalBarrierCount++] = (GraphBarrier) {
+            .resource = r,
+            .srcStages = states[r].writeStages | states[r].readStages,
+            .srcAccess = states[r].writeAccess,
+            .dstStages = resource->finalStages,
+            .dstAccess = 0,
+            .oldLayout = states[r].layout,
+            .newLayout = resource->finalLayout,
+        };
+    }
+    pGraph->barrierCount += pGraph->finalBarrierCount;
+}
+
+VkResult renderGraphCompile(RenderGraph *pGraph){
+    cullPasses(pGraph);
+
+    VkResult result = allocateTransients(pGraph);
+    pGraph->compiled = true;
+    if(result != VK_SUCCESS)
+        return result;
+
+    placeBarriers(pGraph);
+    return VK_SUCCESS;
+}
+
+void renderGraphSetImage(RenderGraph *pGraph, RenderGraphResource resource, VkImage image, VkImageView view){
+    pGraph->resources[resource].image = image;
+    pGraph->resources[resource].view = view;
+}
+
+VkImage renderGraphImage(RenderGraph *pGraph, RenderGraphResource resource){
+    return pGraph->resources[resource].image;
+}
+
+VkImageView renderGraphImageView(RenderGraph *pGraph, RenderGraphResource resource){
+    return pGraph->resources[resource].view;
+}
+
+static void recordBarriers(RenderGraph *pGraph, VkCommandBuffer commandBuffer,
+    const GraphBarrier *barriers, uint32_t count){
+    if(count == 0)
+        return;
+
+    VkImageSubresourceRange ranges[RENDER_GRAPH_MAX_RESOURCES];
+    for(uint32_t i = 0; i < count; i++){
+        ranges[i] = (VkImageSubresourceRange) {
+            .aspectMask = pGraph->resources[barriers[i].resource].aspect,
+            .baseMipLevel = 0,
+            .levelCount = VK_REMAINING_MIP_LEVELS,
+            .baseArrayLayer = 0,
+            .layerCount = VK_REMAINING_ARRAY_LAYERS,
+        };
+    }
+
+    if(pGraph->cmdPipelineBarrier2 != NULL){
+        VkImageMemoryBarrier2KHR imageBarriers[RENDER_GRAPH_MAX_RESOURCES];
+        for(uint32_t i = 0; i < count; i++){
+            imageBarriers[i] = (VkImageMemoryBarrier2KHR) {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+                .srcStageMask = barriers[i].srcStages,
+                .srcAccessMask = barriers[i].srcAccess,
+                .dstStageMask = barriers[i].dstStages,
+                .dstAccessMask = barriers[i].dstAccess,
+                .oldLayout = barriers[i].oldLayout,
+                .newLayout = barriers[i].newLayout,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = pGraph->resources[barriers[i].resource].image,
+                .subresourceRange = ranges[i],
+            };
+        }
+
+        VkDependencyInfoKHR dependencyInfo = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
+            .imageMemoryBarrierCount = count,
+            .pImageMemoryBarriers = imageBarriers,
+        };
+        pGraph->cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+        return;
+    }
+
+    // Without synchronization2 one call covers the union of the stage masks.
+    // Passes only use stages that have the same bit in VkPipelineStageFlags.
+    VkImageMemoryBarrier imageBarriers[RENDER_GRAPH_MAX_RESOURCES];
+    VkPipelineStageFlags2KHR srcStages = 0, dstStages = 0;
+    for(uint32_t i = 0; i < count; i++){
+        srcStages |= barriers[i].srcStages;
+        dstStages |= barriers[i].dstStages;
+        imageBarriers[i] = (VkImageMemoryBarrier) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = (VkAccessFlags) barriers[i].srcAccess,
+            .dstAccessMask = (VkAccessFlags) barriers[i].dstAccess,
+            .oldLayout = barriers[i].oldLayout,
+            .newLayout = barriers[i].newLayout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = pGraph->resources[barriers[i].resource].image,
+            .subresourceRange = ranges[i],
+        };
+    }
+
+    vkCmdPipelineBarrier(commandBuffer,
+        srcStages != 0 ? (VkPipelineStageFlags) srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        dstStages != 0 ? (VkPipelineStageFlags) dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0, 0, NULL, 0, NULL, count, imageBarriers);
+}
+
+void renderGraphExecute(RenderGraph *pGraph, VkCommandBuffer commandBuffer){
+    for(uint32_t p = 0; p < pGraph->passCount; p++){
+        GraphPass *pass = &pGraph->passes[p];
+        if(pass->culled)
+            continue;
+
+        recordBarriers(pGraph, commandBuffer, pass->barriers, pass->barrierCount);
+        pass->record(pass->pContext, commandBuffer);
+    }
+    recordBarriers(pGraph, commandBuffer, pGraph->finalBarriers, pGraph->finalBarrierCount);
+}
+
+void renderGraphDestroy(RenderGraph *pGraph){
+    for(uint32_t r = 0; r < pGraph->resourceCount; r++){
+        GraphResource *resource = &pGraph->resources[r];
+        if(resource->imported)
+            continue;
+        if(resource->view != VK_NULL_HANDLE)
+            vkDestroyImageView(pGraph->device, resource->view, NULL);
+        if(resource->image != VK_NULL_HANDLE)
+            vkDestroyImage(pGraph->device, resource->image, NULL);
+    }
+
+    if(pGraph->transientAllocation.memory != VK_NULL_HANDLE)
+        gpuFree(pGraph->pAllocator, &pGraph->transientAllocation);
+
+    renderGraphInit(pGraph, pGraph->device, pGraph->pAllocator, pGraph->cmdPipelineBarrier2);
+}
+
+void renderGraphWriteStats(RenderGraph *pGraph, FILE *file){
+    fprintf(file, "render graph: %u passes, %u culled, %u barriers with %s, transient memory %llu bytes "
+        "(%llu without aliasing)\n", pGraph->passCount, pGraph->culledCount, pGraph->barrierCount,
+        pGraph->cmdPipelineBarrier2 != NULL ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier",
+        (unsigned long long) pGraph->transientBytes, (unsigned long long) pGraph->unaliasedBytes);
+
+    for(uint32_t p = 0; p < pGraph->passCount; p++){
+        GraphPass *pass = &pGraph->passes[p];
+        fprintf(file, "  %-16s %s, %u barriers\n", pass->name, pass->culled ? "culled" : "kept",
+            pass->barrierCount);
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.h"
+
+/* Render graph.
+ * Passes declare the images they read and write with the stages, access and
+ * layout of each use. renderGraphCompile culls passes whose results are never
+ * used, places the fewest barriers that order every use after the previous
+ * write (and every write after the previous reads), and packs transient
+ * images whose lifetimes don't overlap into the same memory. Imported images
+ * are owned outside the graph and set before every execution, so one compiled
+ * graph is replayed for every frame and swap chain image. */
+
+#define RENDER_GRAPH_MAX_RESOURCES 16
+#define RENDER_GRAPH_MAX_PASSES 16
+#define RENDER_GRAPH_MAX_ACCESSES 8 // per pass
+
+typedef uint32_t RenderGraphResource;
+
+typedef void (*RenderGraphRecord)(void *pContext, VkCommandBuffer commandBuffer);
+
+typedef struct GraphResource {
+    const char *name;
+    bool imported;
+    VkImageAspectFlags aspect;
+
+    // Imported: the producer outside the graph finished in initialStages, the
+    // consumer after it starts in finalStages
+    VkImageLayout initialLayout;
+    VkPipelineStageFlags2KHR initialStages;
+    VkImageLayout finalLayout;
+    VkPipelineStageFlags2KHR finalStages;
+
+    // Transient: created by renderGraphCompile
+    VkImageCreateInfo createInfo;
+    VkMemoryRequirements memoryRequirements;
+    VkDeviceSize offset; // into the shared transient allocation
+
+    VkImage image;
+    VkImageView view;
+    uint32_t firstPass; // RENDER_GRAPH_MAX_PASSES: unused after culling
+    uint32_t lastPass;
+} GraphResource;
+
+typedef struct GraphAccess {
+    RenderGraphResource resource;
+    VkPipelineStageFlags2KHR stages;
+    VkAccessFlags2KHR access;
+    VkImageLayout layout;
+    bool write;
+} GraphAccess;
+
+typedef struct GraphBarrier {
+    RenderGraphResource resource;
+    VkPipelineStageFlags2KHR srcStages;
+    VkAccessFlags2KHR srcAccess;
+    VkPipelineStageFlags2KHR dstStages;
+    VkAccessFlags2KHR dstAccess;
+    VkImageLayout oldLayout;
+    VkImageLayout newLayout;
+} GraphBarrier;
+
+typedef struct GraphPass {
+    const char *name;
+    bool sideEffects; // writes something outside the graph, never culled
+    bool culled;
+    RenderGraphRecord record;
+    void *pContext;
+
+    GraphAccess accesses[RENDER_GRAPH_MAX_ACCESSES];
+    uint32_t accessCount;
+    GraphBarrier barriers[RENDER_GRAPH_MAX_ACCESSES]; // emitted before the pass
+    uint32_t barrierCount;
+} GraphPass;
+
+typedef struct RenderGraph {
+    VkDevice device;
+    GpuAllocator *pAllocator;
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2; // NULL: vkCmdPipelineBarrier
+
+    GraphResource resources[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t resourceCount;
+    GraphPass passes[RENDER_GRAPH_MAX_PASSES];
+    uint32_t passCount;
+
+    // Set by renderGraphCompile
+    GraphBarrier finalBarriers[RENDER_GRAPH_MAX_RESOURCES]; // imported images to their final layout
+    uint32_t finalBarrierCount;
+    GpuAllocation transientAllocation;
+    VkDeviceSize transientBytes; // with aliasing
+    VkDeviceSize unaliasedBytes; // what the transients would take one after another
+    uint32_t culledCount;
+    uint32_t barrierCount;
+    bool compiled;
+} RenderGraph;
+
+void renderGraphInit(RenderGraph *pGraph, VkDevice device, GpuAllocator *pAllocator,
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2);
+
+RenderGraphResource renderGraphImportImage(RenderGraph *pGraph, const char *name, VkImageAspectFlags aspect,
+    VkImageLayout initialLayout, VkPipelineStageFlags2KHR initialStages,
+    VkImageLayout finalLayout, VkPipelineStageFlags2KHR finalStages);
+
+// Transient image with a 2D view; its contents don't survive between executions
+RenderGraphResource renderGraphCreateImage(RenderGraph *pGraph, const char *name, VkImageAspectFlags aspect,
+    const VkImageCreateInfo *pCreateInfo);
+
+uint32_t renderGraphAddPass(RenderGraph *pGraph, const char *name, bool sideEffects,
+    RenderGraphRecord record, void *pContext);
+
+void renderGraphRead(RenderGraph *pGraph, uint32_t pass, RenderGraphResource resource,
+    VkPipelineStageFlags2KHR stages, VkAccessFlags2KHR access, VkImageLayout layout);
+
+void renderGraphWrite(RenderGraph *pGraph, uint32_t pass, RenderGraphResource resource,
+    VkPipelineStageFlags2KHR stages, VkAccessFlags2KHR access, VkImageLayout layout);
+
+// Passes and resources can't be added afterwards
+VkResult renderGraphCompile(RenderGraph *pGraph);
+
+void renderGraphSetImage(RenderGraph *pGraph, RenderGraphResource resource, VkImage image, VkImageView view);
+
+VkImage renderGraphImage(RenderGraph *pGraph, RenderGraphResource resource);
+
+VkImageView renderGraphImageView(RenderGraph *pGraph, RenderGraphResource resource);
+
+// Records every pass that survived culling with its barriers, then the final transitions
+void renderGraphExecute(RenderGraph *pGraph, VkCommandBuffer commandBuffer);
+
+// The device must be done with every execution
+void renderGraphDestroy(RenderGraph *pGraph);
+
+void renderGraphWriteStats(RenderGraph *pGraph, FILE *file);
+
+#endif
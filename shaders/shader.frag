@@ -1,9 +1,11 @@
 #version 450
 
+layout(constant_id = 0) const float brightness = 1.0;
+
 layout(location = 0) in vec3 fragColor;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+    outColor = vec4(fragColor * brightness, 1.0);
+}
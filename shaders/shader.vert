@@ -1,20 +1,29 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(location = 0) out vec3 fragColor;
+struct Instance {
+    vec2 offset;
+    float scale;
+    float pad;
+    vec4 color;
+};
+
+// Storage buffer array of the bindless descriptor heap
+layout(std430, set = 0, binding = 0) readonly buffer Instances {
+    Instance instances[];
+} buffers[];
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(push_constant) uniform Draw {
+    uint instanceBuffer;
+};
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
-}
\ No newline at end of file
+    Instance instance = buffers[instanceBuffer].instances[gl_InstanceIndex];
+    gl_Position = vec4(inPosition * instance.scale + instance.offset, 0.0, 1.0);
+    fragColor = inColor * instance.color.rgb;
+}
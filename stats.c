@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "stats.h"
+
+static const char *timerNames[FRAME_TIMER_COUNT] = {
+    [FRAME_TIMER_FRAME] = "frame",
+    [FRAME_TIMER_WAIT_FRAME] = "wait_frame",
+    [FRAME_TIMER_ACQUIRE] = "acquire",
+    [FRAME_TIMER_RECORD] = "record",
+    [FRAME_TIMER_SUBMIT] = "submit",
+    [FRAME_TIMER_PRESENT] = "present",
+    [FRAME_TIMER_GPU_RENDER_PASS] = "gpu_render_pass",
+    [FRAME_TIMER_UPLOAD_WAIT] = "upload_wait",
+    [FRAME_TIMER_RECREATE] = "recreate_swapchain",
+    [FRAME_TIMER_RESIZE_LATENCY] = "resize_latency",
+};
+
+double getTimeMs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1000.0 + (double) ts.tv_nsec / 1000000.0;
+}
+
+const char *frameTimerName(FrameTimer timer){
+    return timerNames[timer];
+}
+
+void statsSetLabel(FrameStats *pStats, const char *key, const char *value){
+    StatsLabel *label = NULL;
+    for(uint32_t i = 0; i < pStats->labelCount; i++){
+        if(strcmp(pStats->labels[i].key, key) == 0){
+            label = &pStats->labels[i];
+            break;
+        }
+    }
+
+    if(label == NULL){
+        if(pStats->labelCount == STATS_MAX_LABELS)
+            return;
+        label = &pStats->labels[pStats->labelCount++];
+        snprintf(label->key, STATS_LABEL_LENGTH, "%s", key);
+    }
+    snprintf(label->value, STATS_LABEL_LENGTH, "%s", value);
+}
+
+void statsRecord(FrameStats *pStats, FrameTimer timer, double ms){
+    StatsRing *ring = &pStats->timers[timer];
+
+    ring->samples[ring->head] = ms;
+    ring->head = (ring->head + 1) % STATS_RING_SIZE;
+    if(ring->count < STATS_RING_SIZE)
+        ring->count++;
+}
+
+// Drops all samples, labels and the frame count are kept
+void statsReset(FrameStats *pStats){
+    for(int i = 0; i < FRAME_TIMER_COUNT; i++){
+        pStats->timers[i].head = 0;
+        pStats->timers[i].count = 0;
+    }
+}
+
+static int compareDouble(const void *a, const void *b){
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile over an ascending array
+static double percentile(const double *sorted, uint32_t count, double p){
+    uint32_t rank = (uint32_t) ceil(p / 100.0 * count);
+    if(rank == 0)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+TimerSummary statsSummarize(FrameStats *pStats, FrameTimer timer){
+    StatsRing *ring = &pStats->timers[timer];
+    TimerSummary summary = { .count = ring->count };
+
+    if(ring->count == 0)
+        return summary;
+
+    memcpy(pStats->scratch, ring->samples, sizeof(double) * ring->count);
+    qsort(pStats->scratch, ring->count, sizeof(double), compareDouble);
+
+    double sum = 0.0;
+    for(uint32_t i = 0; i < ring->count; i++)
+        sum += pStats->scratch[i];
+
+    summary.mean = sum / ring->count;
+    summary.p50 = percentile(pStats->scratch, ring->count, 50.0);
+    summary.p95 = percentile(pStats->scratch, ring->count, 95.0);
+    summary.p99 = percentile(pStats->scratch, ring->count, 99.0);
+    summary.max = pStats->scratch[ring->count - 1];
+
+    return summary;
+}
+
+// Labels share one column as key=value pairs so the header never changes between dumps
+static void writeCsvLabels(FrameStats *pStats, FILE *file){
+    for(uint32_t i = 0; i < pStats->labelCount; i++){
+        fprintf(file, "%s%s=%s", i == 0 ? "" : ";", pStats->labels[i].key, pStats->labels[i].value);
+    }
+}
+
+static void writeCsv(FrameStats *pStats, FILE *file){
+    // Header only once, the frame column tells periodic dumps apart
+    if(!pStats->csvHeaderWritten){
+        fprintf(file, "frame,labels,timer,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+        pStats->csvHeaderWritten = true;
+    }
+
+    for(int i = 0; i < FRAME_TIMER_COUNT; i++){
+        TimerSummary s = statsSummarize(pStats, (FrameTimer) i);
+        if(s.count == 0)
+            continue;
+        fprintf(file, "%llu,", (unsigned long long) pStats->frameCount);
+        writeCsvLabels(pStats, file);
+        fprintf(file, ",%s,%u,%.4f,%.4f,%.4f,%.4f,%.4f\n", timerNames[i], s.count,
+            s.mean, s.p50, s.p95, s.p99, s.max);
+    }
+}
+
+// One JSON object per line so periodic dumps can be appended to the same file
+static void writeJson(FrameStats *pStats, FILE *file){
+    fprintf(file, "{\"frame\":%llu", (unsigned long long) pStats->frameCount);
+    for(uint32_t i = 0; i < pStats->labelCount; i++){
+        fprintf(file, ",\"%s\":\"%s\"", pStats->labels[i].key, pStats->labels[i].value);
+    }
+    fprintf(file, ",\"timers\":{");
+
+    bool first = true;
+    for(int i = 0; i < FRAME_TIMER_COUNT; i++){
+        TimerSummary s = statsSummarize(pStats, (FrameTimer) i);
+        if(s.count == 0)
+            continue;
+        fprintf(file, "%s\"%s\":{\"count\":%u,\"mean_ms\":%.4f,\"p50_ms\":%.4f,"
+            "\"p95_ms\":%.4f,\"p99_ms\":%.4f,\"max_ms\":%.4f}",
+            first ? "" : ",", timerNames[i], s.count, s.mean, s.p50, s.p95, s.p99, s.max);
+        first = false;
+    }
+
+    fprintf(file, "}}\n");
+}
+
+void statsWrite(FrameStats *pStats, FILE *file, StatsFormat format){
+    if(format == STATS_FORMAT_JSON){
+        writeJson(pStats, file);
+    }else{
+        writeCsv(pStats, file);
+    }
+    fflush(file);
+}
@@ -0,0 +1,81 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Rolling frame timing statistics.
+ * Every timer keeps its last STATS_RING_SIZE samples in a fixed ring, so
+ * recording a sample never allocates. Percentiles are computed on demand
+ * from a copy of the ring kept in FrameStats itself. */
+
+#define STATS_RING_SIZE 1024
+#define STATS_MAX_LABELS 8
+#define STATS_LABEL_LENGTH 32
+
+typedef enum FrameTimer {
+    FRAME_TIMER_FRAME,          // whole drawFrame on the CPU
+    FRAME_TIMER_WAIT_FRAME,     // host wait on the frame timeline semaphore
+    FRAME_TIMER_ACQUIRE,        // vkAcquireNextImageKHR
+    FRAME_TIMER_RECORD,         // command buffer recording
+    FRAME_TIMER_SUBMIT,         // vkQueueSubmit
+    FRAME_TIMER_PRESENT,        // vkQueuePresentKHR
+    FRAME_TIMER_GPU_RENDER_PASS, // timestamp delta around the render pass
+    FRAME_TIMER_UPLOAD_WAIT,    // host wait on a staging upload fence
+    FRAME_TIMER_RECREATE,       // recreateSwapChain
+    FRAME_TIMER_RESIZE_LATENCY, // first resize event of a burst until its recreation is done
+    FRAME_TIMER_COUNT
+} FrameTimer;
+
+typedef enum StatsFormat {
+    STATS_FORMAT_CSV,
+    STATS_FORMAT_JSON,
+} StatsFormat;
+
+typedef struct StatsRing {
+    double samples[STATS_RING_SIZE];
+    uint32_t head;
+    uint32_t count;
+} StatsRing;
+
+// Run configuration written next to the timers, e.g. present_mode=mailbox
+typedef struct StatsLabel {
+    char key[STATS_LABEL_LENGTH];
+    char value[STATS_LABEL_LENGTH];
+} StatsLabel;
+
+typedef struct FrameStats {
+    StatsRing timers[FRAME_TIMER_COUNT];
+    StatsLabel labels[STATS_MAX_LABELS];
+    uint32_t labelCount;
+    double scratch[STATS_RING_SIZE];
+    uint64_t frameCount;
+    bool csvHeaderWritten;
+} FrameStats;
+
+typedef struct TimerSummary {
+    uint32_t count;
+    double mean;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+} TimerSummary;
+
+// Monotonic clock in milliseconds, shared by every timer
+double getTimeMs(void);
+
+const char *frameTimerName(FrameTimer timer);
+
+void statsSetLabel(FrameStats *pStats, const char *key, const char *value);
+
+void statsRecord(FrameStats *pStats, FrameTimer timer, double ms);
+
+void statsReset(FrameStats *pStats);
+
+TimerSummary statsSummarize(FrameStats *pStats, FrameTimer timer);
+
+void statsWrite(FrameStats *pStats, FILE *file, StatsFormat format);
+
+#endif
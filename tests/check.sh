@@ -0,0 +1,146 @@
+#!/bin/sh
+# Regression harness, run through make check / bench / golden / baseline.
+#   check     render every scene offscreen, compare frame 10 to tests/golden
+#   bench     render every scene, compare startup phases and frame times
+#             to tests/baseline.txt
+#   golden    regenerate tests/golden from the current build
+#   baseline  regenerate tests/baseline.txt from the current build
+# Meant to run on a software ICD for reproducible output, e.g.
+#   VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json make check
+# The references are generated per setup and not checked in. A scene without a
+# golden image, or a bench run without a baseline, fails the run unless
+# ALLOW_MISSING_REFS=1, which reports it as SKIP instead.
+
+set -u
+
+MODE=${1:-check}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+VULKAN=$ROOT/vulkan
+REGRESS=$ROOT/tests/regress
+GOLDEN=$ROOT/tests/golden
+BASELINE=$ROOT/tests/baseline.txt
+OUT=$ROOT/tests/out
+
+# Image tolerance: channel difference, and the fraction of pixels allowed past it
+MAX_DIFF=${MAX_DIFF:-2}
+MAX_BAD_FRACTION=${MAX_BAD_FRACTION:-0.001}
+# Timing tolerance: a metric fails above baseline * BENCH_RATIO and BENCH_MIN_MS past it
+BENCH_RATIO=${BENCH_RATIO:-1.5}
+BENCH_MIN_MS=${BENCH_MIN_MS:-0.5}
+BENCH_FRAMES=${BENCH_FRAMES:-300}
+ALLOW_MISSING_REFS=${ALLOW_MISSING_REFS:-0}
+
+# Metrics kept in the baseline, the rest of each run is only reported
+BASELINE_METRICS='\.(time_to_first_frame|startup\.create[A-Za-z]+|frame\.p(50|95)|record\.p50|gpu_render_pass\.p50|recreate_swapchain\.p(50|95)) '
+
+# missingReference WHAT: fails, or skips with ALLOW_MISSING_REFS=1
+missingReference(){
+    if [ "$ALLOW_MISSING_REFS" = 1 ]; then
+        echo "SKIP $1, run make golden / make baseline on the reference setup"
+        skipped=$((skipped + 1))
+    else
+        echo "FAIL $1, run make golden / make baseline on the reference setup" \
+            "(ALLOW_MISSING_REFS=1 skips it)"
+        failed=1
+    fi
+}
+
+# name:options. Scenes must not depend on wall time, so no --animate.
+SCENES='triangle:
+instances:--instances 10000
+batched:--instances 10000 --draw-batch 100 --record-mode dynamic
+recreate:--instances 100 --recreate-interval 5
+dynamic:--instances 10000 --dynamic-rendering --recreate-interval 5
+windows:--instances 1000 --windows 3 --record-mode dynamic
+variant:--instances 100 --topology line_strip --cull-mode none --blend additive --brightness half'
+
+# renderScene NAME FRAMES OPTIONS...
+renderScene(){
+    name=$1
+    frames=$2
+    shift 2
+    dir=$OUT/$name
+    rm -rf "$dir"
+    mkdir -p "$dir"
+
+    # A fresh pipeline cache per run keeps createGraphicsPipeline comparable
+    "$VULKAN" --headless --frames "$frames" --pipeline-cache "$dir/pipeline_cache.bin" \
+        --startup-trace "$dir/startup.json" --stats-file "$dir/stats.csv" --stats-format csv \
+        "$@" > "$dir/log.txt" 2>&1
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "FAIL $name: vulkan exited with $status, see $dir/log.txt"
+        return 1
+    fi
+}
+
+# "scene.metric milliseconds" lines from the startup trace and the stats dump
+sceneMetrics(){
+    name=$1
+    dir=$OUT/$name
+    sed -n 's/.*"time_to_first_frame_ms":\([0-9.]*\).*/'"$name"'.time_to_first_frame \1/p' "$dir/startup.json"
+    tr '{' '\n' < "$dir/startup.json" |
+        sed -n 's/^"name":"\([^"]*\)".*,"ms":\([0-9.]*\).*/'"$name"'.startup.\1 \2/p'
+    awk -F, -v scene="$name" 'NR > 1 { print scene "." $3 ".p50 " $6; print scene "." $3 ".p95 " $7 }' \
+        "$dir/stats.csv"
+}
+
+if [ ! -x "$VULKAN" ] || [ ! -x "$REGRESS" ]; then
+    echo "build first: make vulkan tests/regress"
+    exit 2
+fi
+
+failed=0
+skipped=0
+mkdir -p "$OUT"
+: > "$OUT/metrics.txt"
+
+while IFS=: read -r name options; do
+    case $MODE in
+    check|golden)
+        # shellcheck disable=SC2086 # options are split on purpose
+        renderScene "$name" 20 --capture "$OUT/$name" --capture-interval 10 $options || { failed=1; continue; }
+        frame=$OUT/$name/frame_000010.ppm
+        if [ "$MODE" = golden ]; then
+            mkdir -p "$GOLDEN"
+            cp "$frame" "$GOLDEN/$name.ppm" && echo "updated $GOLDEN/$name.ppm"
+        elif [ ! -f "$GOLDEN/$name.ppm" ]; then
+            missingReference "$name: no golden image"
+        else
+            "$REGRESS" image "$frame" "$GOLDEN/$name.ppm" "$MAX_DIFF" "$MAX_BAD_FRACTION" || failed=1
+        fi
+        ;;
+    bench|baseline)
+        # shellcheck disable=SC2086
+        renderScene "$name" "$BENCH_FRAMES" $options || { failed=1; continue; }
+        sceneMetrics "$name" >> "$OUT/metrics.txt"
+        ;;
+    *)
+        echo "unknown mode: $MODE (check, bench, golden or baseline)"
+        exit 2
+        ;;
+    esac
+done <<SCENES_END
+$SCENES
+SCENES_END
+
+if [ "$MODE" = baseline ] && [ $failed -eq 0 ]; then
+    driver=$(vulkaninfo --summary 2>/dev/null | sed -n 's/^[[:space:]]*driverInfo[[:space:]]*= //p' | head -n 1)
+    { echo "# generated by make baseline, driver: ${driver:-unknown}"; grep -E "$BASELINE_METRICS" "$OUT/metrics.txt"; } > "$BASELINE"
+    echo "updated $BASELINE"
+elif [ "$MODE" = bench ] && [ $failed -eq 0 ]; then
+    if [ ! -f "$BASELINE" ]; then
+        missingReference "bench: no baseline"
+    else
+        "$REGRESS" timing "$OUT/metrics.txt" "$BASELINE" "$BENCH_RATIO" "$BENCH_MIN_MS" || failed=1
+    fi
+fi
+
+if [ $failed -ne 0 ]; then
+    echo "$MODE failed"
+elif [ $skipped -ne 0 ]; then
+    echo "$MODE passed, $skipped skipped for missing references"
+else
+    echo "$MODE passed"
+fi
+exit $failed
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../graph.h"
+
+/* Render graph compile test, run by make check without a device.
+ * graph.c is linked against the fake Vulkan and allocator calls below, which
+ * hand out numbered handles and report a fixed size per image. The graph has
+ * three transients, a pass whose output nothing reads and an imported target:
+ *   depth    writes A
+ *   lighting reads A, writes B
+ *   debug    writes C, culled
+ *   bloom    reads B, writes D, D only lives after A and takes its memory
+ *   compose  reads B again and D, writes the target
+ * Exit status 0 on success, 1 on a failed check. */
+
+#define MAX_FAKE_IMAGES 16
+#define MAX_RECORDED_BARRIERS 32
+#define FAKE_ALIGNMENT 65536
+
+typedef struct FakeImage {
+    VkImageCreateInfo createInfo;
+    VkDeviceSize offset;
+    bool bound;
+    bool destroyed;
+} FakeImage;
+
+typedef struct RecordedBarrier {
+    uint32_t pass; // recorded before this pass, passCount for the final transitions
+    VkImage image;
+    VkPipelineStageFlags2KHR srcStages;
+    VkAccessFlags2KHR srcAccess;
+    VkImageLayout oldLayout;
+    VkImageLayout newLayout;
+} RecordedBarrier;
+
+static FakeImage fakeImages[MAX_FAKE_IMAGES];
+static uint32_t fakeImageCount;
+static VkDeviceSize allocatedBytes;
+static bool allocationFreed;
+
+static RecordedBarrier recorded[MAX_RECORDED_BARRIERS];
+static uint32_t recordedCount;
+static uint32_t barrierCalls;
+static const char *recordedPasses[RENDER_GRAPH_MAX_PASSES];
+static uint32_t recordedPassCount;
+
+static int failures;
+
+static FakeImage *fakeImage(VkImage image){
+    return &fakeImages[(uintptr_t) image - 1];
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateImage(VkDevice device, const VkImageCreateInfo *pCreateInfo,
+    const VkAllocationCallbacks *pAllocator, VkImage *pImage){
+    if(fakeImageCount == MAX_FAKE_IMAGES)
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    fakeImages[fakeImageCount] = (FakeImage) {.createInfo = *pCreateInfo};
+    *pImage = (VkImage) (uintptr_t) ++fakeImageCount;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetImageMemoryRequirements(VkDevice device, VkImage image,
+    VkMemoryRequirements *pMemoryRequirements){
+    const VkExtent3D *extent = &fakeImage(image)->createInfo.extent;
+    *pMemoryRequirements = (VkMemoryRequirements) {
+        .size = (VkDeviceSize) extent->width * extent->height * 4,
+        .alignment = FAKE_ALIGNMENT,
+        .memoryTypeBits = 0x3,
+    };
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkBindImageMemory(VkDevice device, VkImage image, VkDeviceMemory memory,
+    VkDeviceSize memoryOffset){
+    fakeImage(image)->offset = memoryOffset;
+    fakeImage(image)->bound = true;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateImageView(VkDevice device, const VkImageViewCreateInfo *pCreateInfo,
+    const VkAllocationCallbacks *pAllocator, VkImageView *pView){
+    *pView = (VkImageView) (uintptr_t) ((uintptr_t) pCreateInfo->image + 100);
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyImageView(VkDevice device, VkImageView imageView,
+    const VkAllocationCallbacks *pAllocator){
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyImage(VkDevice device, VkImage image, const VkAllocationCallbacks *pAllocator){
+    fakeImage(image)->destroyed = true;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdPipelineBarrier(VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask, VkDependencyFlags dependencyFlags,
+    uint32_t memoryBarrierCount, const VkMemoryBarrier *pMemoryBarriers,
+    uint32_t bufferMemoryBarrierCount, const VkBufferMemoryBarrier *pBufferMemoryBarriers,
+    uint32_t imageMemoryBarrierCount, const VkImageMemoryBarrier *pImageMemoryBarriers){
+    barrierCalls++;
+    for(uint32_t i = 0; i < imageMemoryBarrierCount && recordedCount < MAX_RECORDED_BARRIERS; i++){
+        recorded[recordedCount++] = (RecordedBarrier) {
+            .pass = recordedPassCount,
+            .image = pImageMemoryBarriers[i].image,
+            .srcStages = srcStageMask,
+            .srcAccess = pImageMemoryBarriers[i].srcAccessMask,
+            .oldLayout = pImageMemoryBarriers[i].oldLayout,
+            .newLayout = pImageMemoryBarriers[i].newLayout,
+        };
+    }
+}
+
+static VKAPI_ATTR void VKAPI_CALL fakeCmdPipelineBarrier2(VkCommandBuffer commandBuffer,
+    const VkDependencyInfoKHR *pDependencyInfo){
+    barrierCalls++;
+    for(uint32_t i = 0; i < pDependencyInfo->imageMemoryBarrierCount && recordedCount < MAX_RECORDED_BARRIERS; i++){
+        const VkImageMemoryBarrier2KHR *barrier = &pDependencyInfo->pImageMemoryBarriers[i];
+        recorded[recordedCount++] = (RecordedBarrier) {
+            .pass = recordedPassCount,
+            .image = barrier->image,
+            .srcStages = barrier->srcStageMask,
+            .srcAccess = barrier->srcAccessMask,
+            .oldLayout = barrier->oldLayout,
+            .newLayout = barrier->newLayout,
+        };
+    }
+}
+
+VkResult gpuAllocate(GpuAllocator *pAllocator, const VkMemoryRequirements *pRequirements,
+    VkMemoryPropertyFlags properties, GpuAllocation *pAllocation){
+    allocatedBytes = pRequirements->size;
+    *pAllocation = (GpuAllocation) {
+        .memory = (VkDeviceMemory) (uintptr_t) 1,
+        .size = pRequirements->size,
+    };
+    return VK_SUCCESS;
+}
+
+void gpuFree(GpuAllocator *pAllocator, GpuAllocation *pAllocation){
+    allocationFreed = true;
+}
+
+static void recordPass(void *pContext, VkCommandBuffer commandBuffer){
+    recordedPasses[recordedPassCount++] = (const char *) pContext;
+}
+
+static void check(bool condition, const char *description){
+    printf("%s %s\n", condition ? "ok  " : "FAIL", description);
+    if(!condition)
+        failures++;
+}
+
+static const RecordedBarrier *findBarrier(uint32_t pass, VkImage image){
+    for(uint32_t i = 0; i < recordedCount; i++){
+        if(recorded[i].pass == pass && recorded[i].image == image)
+            return &recorded[i];
+    }
+    return NULL;
+}
+
+static bool hasTransition(uint32_t pass, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout){
+    const RecordedBarrier *barrier = findBarrier(pass, image);
+    return barrier != NULL && barrier->oldLayout == oldLayout && barrier->newLayout == newLayout;
+}
+
+static void buildGraph(RenderGraph *pGraph, PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2,
+    RenderGraphResource resources[5]){
+    const VkPipelineStageFlags2KHR colorStage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+    const VkAccessFlags2KHR colorWrite = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+    const VkPipelineStageFlags2KHR fragmentStage = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR;
+    const VkAccessFlags2KHR sampledRead = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR;
+    const VkImageLayout attachment = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    const VkImageLayout sampled = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .extent = {1024, 1024, 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+    };
+
+    renderGraphInit(pGraph, VK_NULL_HANDLE, NULL, cmdPipelineBarrier2);
+    RenderGraphResource a = renderGraphCreateImage(pGraph, "a", VK_IMAGE_ASPECT_COLOR_BIT, &imageInfo);
+    RenderGraphResource b = renderGraphCreateImage(pGraph, "b", VK_IMAGE_ASPECT_COLOR_BIT, &imageInfo);
+    RenderGraphResource c = renderGraphCreateImage(pGraph, "c", VK_IMAGE_ASPECT_COLOR_BIT, &imageInfo);
+    RenderGraphResource d = renderGraphCreateImage(pGraph, "d", VK_IMAGE_ASPECT_COLOR_BIT, &imageInfo);
+    RenderGraphResource target = renderGraphImportImage(pGraph, "target", VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, colorStage, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, colorStage);
+
+    uint32_t depth = renderGraphAddPass(pGraph, "depth", false, recordPass, (void *) "depth");
+    renderGraphWrite(pGraph, depth, a, colorStage, colorWrite, attachment);
+
+    uint32_t lighting = renderGraphAddPass(pGraph, "lighting", false, recordPass, (void *) "lighting");
+    renderGraphRead(pGraph, lighting, a, fragmentStage, sampledRead, sampled);
+    renderGraphWrite(pGraph, lighting, b, colorStage, colorWrite, attachment);
+
+    uint32_t debug = renderGraphAddPass(pGraph, "debug", false, recordPass, (void *) "debug");
+    renderGraphWrite(pGraph, debug, c, colorStage, colorWrite, attachment);
+
+    uint32_t bloom = renderGraphAddPass(pGraph, "bloom", false, recordPass, (void *) "bloom");
+    renderGraphRead(pGraph, bloom, b, fragmentStage, sampledRead, sampled);
+    renderGraphWrite(pGraph, bloom, d, colorStage, colorWrite, attachment);
+
+    uint32_t compose = renderGraphAddPass(pGraph, "compose", false, recordPass, (void *) "compose");
+    renderGraphRead(pGraph, compose, b, fragmentStage, sampledRead, sampled);
+    renderGraphRead(pGraph, compose, d, fragmentStage, sampledRead, sampled);
+    renderGraphWrite(pGraph, compose, target, colorStage, colorWrite, attachment);
+
+    resources[0] = a;
+    resources[1] = b;
+    resources[2] = c;
+    resources[3] = d;
+    resources[4] = target;
+}
+
+static void runGraph(PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2){
+    const VkImageLayout attachment = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    const VkImageLayout sampled = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    const VkDeviceSize imageBytes = 1024 * 1024 * 4;
+
+    memset(fakeImages, 0, sizeof(fakeImages));
+    fakeImageCount = 0;
+    allocatedBytes = 0;
+    allocationFreed = false;
+    recordedCount = 0;
+    barrierCalls = 0;
+    recordedPassCount = 0;
+
+    printf("%s:\n", cmdPipelineBarrier2 != NULL ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier");
+
+    static RenderGraph graph;
+    RenderGraphResource r[5];
+    buildGraph(&graph, cmdPipelineBarrier2, r);
+    check(renderGraphCompile(&graph) == VK_SUCCESS, "graph compiles");
+
+    VkImage a = renderGraphImage(&graph, r[0]);
+    VkImage b = renderGraphImage(&graph, r[1]);
+    VkImage d = renderGraphImage(&graph, r[3]);
+    VkImage target = (VkImage) (uintptr_t) 1000;
+    renderGraphSetImage(&graph, r[4], target, VK_NULL_HANDLE);
+
+    // Culling
+    check(graph.culledCount == 1 && graph.passes[2].culled, "debug pass is culled");
+    check(renderGraphImage(&graph, r[2]) == VK_NULL_HANDLE && fakeImageCount == 3,
+        "image only written by the culled pass is not created");
+
+    // Aliasing
+    check(graph.unaliasedBytes == 3 * imageBytes, "three transients take 12 MiB unaliased");
+    check(graph.transientBytes == 2 * imageBytes && allocatedBytes == 2 * imageBytes,
+        "one 8 MiB allocation holds them with aliasing");
+    check(fakeImage(a)->bound && fakeImage(b)->bound && fakeImage(d)->bound, "transients are bound");
+    check(fakeImage(d)->offset == fakeImage(a)->offset, "d reuses the memory of a");
+    check(fakeImage(b)->offset >= fakeImage(a)->offset + imageBytes ||
+        fakeImage(a)->offset >= fakeImage(b)->offset + imageBytes, "b doesn't overlap a");
+
+    // Execution and barriers
+    renderGraphExecute(&graph, VK_NULL_HANDLE);
+    check(recordedPassCount == 4 && strcmp(recordedPasses[0], "depth") == 0 &&
+        strcmp(recordedPasses[1], "lighting") == 0 && strcmp(recordedPasses[2], "bloom") == 0 &&
+        strcmp(recordedPasses[3], "compose") == 0, "surviving passes are recorded in order");
+    check(graph.barrierCount == 8 && recordedCount == 8, "8 barriers placed and recorded");
+    check(barrierCalls == 5, "one barrier call per pass and one for the final transitions");
+
+    check(hasTransition(0, a, VK_IMAGE_LAYOUT_UNDEFINED, attachment), "depth: a to attachment");
+    check(hasTransition(1, a, attachment, sampled) &&
+        (findBarrier(1, a)->srcStages & VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR) &&
+        (findBarrier(1, a)->srcAccess & VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR),
+        "lighting: a waits for its write and moves to sampled");
+    // vkCmdPipelineBarrier takes one stage mask per call, so only synchronization2 shows b's own
+    check(hasTransition(1, b, VK_IMAGE_LAYOUT_UNDEFINED, attachment) &&
+        (cmdPipelineBarrier2 == NULL || findBarrier(1, b)->srcStages == 0), "lighting: b has nothing to wait for");
+    check(hasTransition(2, b, attachment, sampled), "bloom: b to sampled");
+    check(hasTransition(2, d, VK_IMAGE_LAYOUT_UNDEFINED, attachment) &&
+        (findBarrier(2, d)->srcStages & VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR),
+        "bloom: d waits for the reads of a before reusing its memory");
+    check(findBarrier(3, b) == NULL, "compose: no barrier for b, already visible to the fragment shader");
+    check(hasTransition(3, d, attachment, sampled), "compose: d to sampled");
+    check(hasTransition(3, target, VK_IMAGE_LAYOUT_UNDEFINED, attachment), "compose: target to attachment");
+    check(hasTransition(4, target, attachment, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR), "final: target to present");
+
+    renderGraphDestroy(&graph);
+    check(fakeImage(a)->destroyed && fakeImage(b)->destroyed && fakeImage(d)->destroyed && allocationFreed,
+        "transients and their memory are freed");
+}
+
+int main(void){
+    runGraph(fakeCmdPipelineBarrier2);
+    runGraph(NULL);
+
+    if(failures != 0)
+        printf("render graph: %d checks failed\n", failures);
+    return failures != 0 ? 1 : 0;
+}
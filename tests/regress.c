@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Comparison half of the regression harness, driven by tests/check.sh.
+ *   regress image ACTUAL.ppm GOLDEN.ppm MAX_DIFF MAX_BAD_FRACTION
+ *     fails when more than MAX_BAD_FRACTION of the pixels differ from the
+ *     golden image by more than MAX_DIFF in any channel
+ *   regress timing METRICS BASELINE RATIO MIN_MS
+ *     both files hold "name milliseconds" lines; fails when a metric named in
+ *     the baseline is missing or exceeds baseline * RATIO by more than MIN_MS
+ * Exit status 0 on success, 1 on a regression, 2 on bad input. */
+
+#define METRIC_NAME_LENGTH 128
+#define MAX_METRICS 256
+
+typedef struct Image {
+    uint32_t width;
+    uint32_t height;
+    uint8_t *pixels; // RGB
+} Image;
+
+typedef struct Metric {
+    char name[METRIC_NAME_LENGTH];
+    double ms;
+} Metric;
+
+static bool readPpm(const char *path, Image *pImage){
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        printf("failed to open %s\n", path);
+        return false;
+    }
+
+    unsigned width, height, maxValue;
+    if(fscanf(file, "P6 %u %u %u", &width, &height, &maxValue) != 3 || maxValue != 255 || fgetc(file) == EOF){
+        printf("%s is not an 8-bit binary PPM\n", path);
+        fclose(file);
+        return false;
+    }
+
+    size_t size = (size_t) width * height * 3;
+    pImage->width = width;
+    pImage->height = height;
+    pImage->pixels = (uint8_t *) malloc(size);
+    bool complete = fread(pImage->pixels, 1, size, file) == size;
+    fclose(file);
+
+    if(!complete){
+        printf("%s is truncated\n", path);
+        free(pImage->pixels);
+    }
+    return complete;
+}
+
+static int compareImages(const char *actualPath, const char *goldenPath, int maxDiff, double maxBadFraction){
+    Image actual, golden;
+    if(!readPpm(actualPath, &actual))
+        return 2;
+    if(!readPpm(goldenPath, &golden)){
+        free(actual.pixels);
+        return 2;
+    }
+
+    if(actual.width != golden.width || actual.height != golden.height){
+        printf("FAIL %s: %ux%u, golden is %ux%u\n", actualPath, actual.width, actual.height,
+            golden.width, golden.height);
+        free(actual.pixels);
+        free(golden.pixels);
+        return 1;
+    }
+
+    uint64_t pixelCount = (uint64_t) actual.width * actual.height;
+    uint64_t badPixels = 0;
+    int worst = 0;
+    for(uint64_t i = 0; i < pixelCount; i++){
+        int pixelDiff = 0;
+        for(int c = 0; c < 3; c++){
+            int diff = abs((int) actual.pixels[i * 3 + c] - (int) golden.pixels[i * 3 + c]);
+            if(diff > pixelDiff)
+                pixelDiff = diff;
+        }
+        if(pixelDiff > maxDiff)
+            badPixels++;
+        if(pixelDiff > worst)
+            worst = pixelDiff;
+    }
+
+    free(actual.pixels);
+    free(golden.pixels);
+
+    double badFraction = (double) badPixels / pixelCount;
+    bool pass = badFraction <= maxBadFraction;
+    printf("%s %s: %llu of %llu pixels differ by more than %d (max difference %d)\n", pass ? "ok" : "FAIL",
+        actualPath, (unsigned long long) badPixels, (unsigned long long) pixelCount, maxDiff, worst);
+    return pass ? 0 : 1;
+}
+
+static int readMetrics(const char *path, Metric *metrics){
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        printf("failed to open %s\n", path);
+        return -1;
+    }
+
+    int count = 0;
+    char line[512];
+    while(count < MAX_METRICS && fgets(line, sizeof(line), file) != NULL){
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+        if(sscanf(line, "%127s %lf", metrics[count].name, &metrics[count].ms) == 2)
+            count++;
+    }
+
+    fclose(file);
+    return count;
+}
+
+static int compareTimings(const char *metricsPath, const char *baselinePath, double ratio, double minMs){
+    static Metric metrics[MAX_METRICS];
+    static Metric baseline[MAX_METRICS];
+
+    int metricCount = readMetrics(metricsPath, metrics);
+    int baselineCount = readMetrics(baselinePath, baseline);
+    if(metricCount < 0 || baselineCount < 0)
+        return 2;
+
+    int status = 0;
+    for(int b = 0; b < baselineCount; b++){
+        const Metric *expected = &baseline[b];
+        const Metric *measured = NULL;
+        for(int m = 0; m < metricCount; m++){
+            if(strcmp(metrics[m].name, expected->name) == 0){
+                measured = &metrics[m];
+                break;
+            }
+        }
+
+        if(measured == NULL){
+            printf("FAIL %s: not measured\n", expected->name);
+            status = 1;
+            continue;
+        }
+
+        bool regressed = measured->ms > expected->ms * ratio && measured->ms - expected->ms > minMs;
+        printf("%s %-40s %10.3f ms, baseline %10.3f ms (%+.1f%%)\n", regressed ? "FAIL" : "ok  ",
+            expected->name, measured->ms, expected->ms,
+            expected->ms > 0.0 ? (measured->ms / expected->ms - 1.0) * 100.0 : 0.0);
+        if(regressed)
+            status = 1;
+    }
+
+    return status;
+}
+
+int main(int argc, char **argv){
+    if(argc == 6 && strcmp(argv[1], "image") == 0)
+        return compareImages(argv[2], argv[3], atoi(argv[4]), atof(argv[5]));
+    if(argc == 6 && strcmp(argv[1], "timing") == 0)
+        return compareTimings(argv[2], argv[3], atof(argv[4]), atof(argv[5]));
+
+    printf("Usage: %s image ACTUAL.ppm GOLDEN.ppm MAX_DIFF MAX_BAD_FRACTION\n"
+           "       %s timing METRICS BASELINE RATIO MIN_MS\n", argv[0], argv[0]);
+    return 2;
+}
@@ -2,6 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "vulkan.h"
 
@@ -15,7 +20,75 @@ const char *validationLayers[] = {"VK_LAYER_KHRONOS_validation"};
 const u32 deviceExtensionsCount = 1;
 const char *deviceExtensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+const u32 DEFAULT_FRAMES_IN_FLIGHT = 2;
+const u32 MAX_FRAMES_IN_FLIGHT = 8;
+
+const u32 DEFAULT_BENCHMARK_FRAMES = 1000;
+const VkFormat OFFSCREEN_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+const char *DEFAULT_PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+const char *PRESENT_MODE_ENV = "VT_PRESENT_MODE";
+
+const u32 DEFAULT_INIT_THREADS = 4;
+
+const VkDeviceSize FRAME_ARENA_SIZE = 4 << 20;
+
+static const Vertex vertices[] = {
+    {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+    {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
+    {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+};
+
+static const uint16_t indices[] = {0, 1, 2};
+
+#ifdef EMBED_SHADERS
+// glslc -mfmt=c output, generated by make EMBED_SHADERS=1
+static const u32 embeddedVertShader[] =
+#include "shaders/vert.spv.inc"
+;
+static const u32 embeddedFragShader[] =
+#include "shaders/frag.spv.inc"
+;
+static const u32 embeddedCompShader[] =
+#include "shaders/comp.spv.inc"
+;
+#endif
+
+static const u32 instanceSweepCounts[] = {100000, 1000000, 10000000};
+
+// Pipeline variant axes, the first entry of each is the default variant
+static const VkPrimitiveTopology variantTopologies[] = {
+    VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+    VK_PRIMITIVE_TOPOLOGY_LINE_STRIP,
+};
+static const VkCullModeFlags variantCullModes[] = {VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_NONE};
+static const float variantBrightness[] = {1.0f, 0.5f}; // specialization constant 0 of shader.frag
+
+// Command line names of the variant axes above, in the same order
+static const char *variantTopologyNames[] = {"triangle_list", "triangle_strip", "line_strip"};
+static const char *variantCullModeNames[] = {"back", "none"};
+static const char *variantBlendModeNames[BLEND_MODE_COUNT] = {
+    [BLEND_MODE_OPAQUE] = "opaque",
+    [BLEND_MODE_ALPHA] = "alpha",
+    [BLEND_MODE_ADDITIVE] = "additive",
+};
+static const char *variantBrightnessNames[] = {"full", "half"};
+
+static const char *presentPolicyNames[PRESENT_POLICY_COUNT] = {
+    [PRESENT_POLICY_IMMEDIATE] = "immediate",
+    [PRESENT_POLICY_MAILBOX] = "mailbox",
+    [PRESENT_POLICY_FIFO] = "fifo",
+    [PRESENT_POLICY_FIFO_RELAXED] = "fifo_relaxed",
+};
+
+// Preferred modes per policy, first supported one wins. FIFO is always available.
+static const VkPresentModeKHR presentPolicyFallbacks[PRESENT_POLICY_COUNT][3] = {
+    [PRESENT_POLICY_IMMEDIATE] = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR},
+    [PRESENT_POLICY_MAILBOX] = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR},
+    [PRESENT_POLICY_FIFO] = {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR},
+    [PRESENT_POLICY_FIFO_RELAXED] = {VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR},
+};
 
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
@@ -24,47 +97,516 @@ const bool enableValidationLayers = true;
 #endif
 
 
-int main(void){
+int main(int argc, char **argv){
     App window = {0};
+    window.processStart = getTimeMs();
+
+    parseArgs(&window.config, argc, argv);
+    window.windowCount = window.config.windowCount;
+    for(u32 i = 0; i < window.windowCount; i++){
+        window.windows[i].pApp = &window;
+        window.windows[i].index = i;
+        window.windows[i].presentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+    }
 
-    initWindow(&window);
-    initVulkan(&window);
-    mainloop(&window);
+    initApp(&window);
+    reportStartupPhases(&window);
+    if(window.config.headless){
+        runHeadlessBenchmark(&window);
+    }else{
+        mainloop(&window);
+    }
     cleanup(&window);
 
     return 0;
 }
 
-void initWindow(App *pApp){
+static void printUsage(const char *program){
+    printf("Usage: %s [options]\n", program);
+    printf("  --headless     render offscreen without a window (e.g. on lavapipe)\n");
+    printf("  --frames N     number of frames to render in headless mode (default %u)\n",
+        DEFAULT_BENCHMARK_FRAMES);
+    printf("  --pipeline-cache PATH\n"
+           "                 pipeline cache file loaded at startup and saved on exit (default %s)\n",
+        DEFAULT_PIPELINE_CACHE_PATH);
+    printf("  --frames-in-flight N\n"
+           "                 frames the CPU may run ahead of the GPU, 1-%u (default %u)\n",
+        MAX_FRAMES_IN_FLIGHT, DEFAULT_FRAMES_IN_FLIGHT);
+    printf("  --present-mode immediate|mailbox|fifo|fifo_relaxed\n"
+           "                 presentation policy, also read from $%s (default mailbox);\n"
+           "                 press P to cycle through policies at runtime\n", PRESENT_MODE_ENV);
+    printf("  --instances N  number of triangle instances to draw (default 1)\n");
+    printf("  --instance-sweep\n"
+           "                 headless: benchmark 10^5, 10^6 and 10^7 instances and report\n"
+           "                 triangles/sec\n");
+    printf("  --animate      move the instances with a compute pass every frame, on the async\n"
+           "                 compute queue when there is one; needs --record-mode dynamic\n");
+    printf("  --draw-batch N instances per draw call, 0 draws all in one call (default 0)\n");
+    printf("  --record-threads N\n"
+           "                 threads recording secondary command buffers in dynamic\n"
+           "                 record mode, 1-%u (default 1)\n", MAX_RECORD_THREADS);
+    printf("  --thread-sweep headless: benchmark dynamic recording with 1, 2, 4, ... threads\n"
+           "                 up to the number of cores\n");
+    printf("  --compile-threads N\n"
+           "                 threads compiling pipeline variants, 1-%u (default: cores)\n",
+        MAX_COMPILE_THREADS);
+    printf("  --init-threads N\n"
+           "                 threads running independent init stages, 1-%u; 1 runs them\n"
+           "                 in order on the main thread (default %u)\n",
+        MAX_INIT_THREADS, DEFAULT_INIT_THREADS);
+    printf("  --shader-dir DIR\n"
+           "                 load vert.spv and frag.spv from DIR (default: shaders/ next to\n"
+           "                 the executable), unused in EMBED_SHADERS builds\n");
+    printf("  --startup-trace PATH\n"
+           "                 write startup phase timings and time to first frame as JSON\n");
+    printf("  --record-mode static|dynamic\n"
+           "                 pre-record one command buffer per swap chain image, or\n"
+           "                 re-record every frame (default static)\n");
+    printf("  --stats-file PATH\n"
+           "                 write frame timing percentiles to PATH instead of stdout\n");
+    printf("  --stats-format csv|json\n"
+           "                 frame timing output format (default csv)\n");
+    printf("  --capture DIR  write rendered frames to DIR as PPM files from a writer thread;\n"
+           "                 frames are dropped rather than waited for when it falls behind\n");
+    printf("  --capture-interval N\n"
+           "                 capture every N-th frame (default 1)\n");
+    printf("  --recreate-interval N\n"
+           "                 recreate the swap chain (or offscreen targets) every N frames\n");
+    printf("  --baked-variants\n"
+           "                 bake cull mode, topology and blend state into every pipeline\n"
+           "                 variant even when extended dynamic state is supported\n");
+    printf("  --topology triangle_list|triangle_strip|line_strip\n"
+           "  --cull-mode back|none\n"
+           "  --blend opaque|alpha|additive\n"
+           "  --brightness full|half\n"
+           "                 pipeline variant to draw with (default: the first of each)\n");
+    printf("  --dynamic-rendering\n"
+           "                 render with VK_KHR_dynamic_rendering instead of a render pass\n"
+           "                 and framebuffers, when the device supports it\n");
+    printf("  --windows N    render N windows (offscreen targets when headless) from one device,\n"
+           "                 submitted and presented together, 1-%u (default 1)\n", MAX_WINDOWS);
+    printf("  --stats-interval N\n"
+           "                 also dump frame timings every N frames (default: on exit only)\n");
+    printf("  --help         show this message\n");
+}
+
+// Index of value in names, exits on an unknown value
+static u32 parseVariantAxis(const char *option, const char *value, const char **names, u32 count){
+    for(u32 i = 0; i < count; i++){
+        if(strcmp(value, names[i]) == 0)
+            return i;
+    }
+    printf("unknown %s: %s\n", option, value);
+    exit(1);
+}
+
+#define PARSE_VARIANT_AXIS(option, value, names) \
+    parseVariantAxis(option, value, names, sizeof(names) / sizeof(names[0]))
+
+void parseArgs(AppConfig *pConfig, int argc, char **argv){
+    pConfig->headless = false;
+    pConfig->benchmarkFrames = DEFAULT_BENCHMARK_FRAMES;
+    pConfig->pipelineCachePath = DEFAULT_PIPELINE_CACHE_PATH;
+    pConfig->recordMode = RECORD_MODE_STATIC;
+    pConfig->framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    pConfig->presentPolicy = PRESENT_POLICY_MAILBOX;
+    pConfig->instanceCount = 1;
+    pConfig->instanceSweep = false;
+    pConfig->drawBatch = 0;
+    pConfig->recordThreads = 1;
+    pConfig->threadSweep = false;
+    pConfig->shaderDir = NULL;
+    pConfig->startupTracePath = NULL;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    pConfig->compileThreads = cores < 1 ? 1 : (cores > MAX_COMPILE_THREADS ? MAX_COMPILE_THREADS : (u32) cores);
+    pConfig->initThreads = DEFAULT_INIT_THREADS;
+
+    // Command line options below take precedence over the environment
+    const char *envPresentMode = getenv(PRESENT_MODE_ENV);
+    if(envPresentMode != NULL && !parsePresentPolicy(envPresentMode, &pConfig->presentPolicy)){
+        printf("ignoring unknown %s=%s\n", PRESENT_MODE_ENV, envPresentMode);
+    }
+    pConfig->statsPath = NULL;
+    pConfig->statsFormat = STATS_FORMAT_CSV;
+    pConfig->statsInterval = 0;
+    pConfig->captureDir = NULL;
+    pConfig->captureInterval = 1;
+    pConfig->recreateInterval = 0;
+    pConfig->windowCount = 1;
+    pConfig->variantTopology = 0;
+    pConfig->variantCullMode = 0;
+    pConfig->variantBlendMode = BLEND_MODE_OPAQUE;
+    pConfig->variantBrightness = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--headless") == 0){
+            pConfig->headless = true;
+        }else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+            pConfig->benchmarkFrames = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--pipeline-cache") == 0 && i + 1 < argc){
+            pConfig->pipelineCachePath = argv[++i];
+        }else if(strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc){
+            pConfig->framesInFlight = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc){
+            const char *mode = argv[++i];
+            if(!parsePresentPolicy(mode, &pConfig->presentPolicy)){
+                printf("unknown present mode: %s\n", mode);
+                exit(1);
+            }
+        }else if(strcmp(argv[i], "--instances") == 0 && i + 1 < argc){
+            pConfig->instanceCount = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--instance-sweep") == 0){
+            pConfig->instanceSweep = true;
+        }else if(strcmp(argv[i], "--draw-batch") == 0 && i + 1 < argc){
+            pConfig->drawBatch = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc){
+            pConfig->recordThreads = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--compile-threads") == 0 && i + 1 < argc){
+            pConfig->compileThreads = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--animate") == 0){
+            pConfig->animate = true;
+        }else if(strcmp(argv[i], "--baked-variants") == 0){
+            pConfig->bakedVariants = true;
+        }else if(strcmp(argv[i], "--topology") == 0 && i + 1 < argc){
+            pConfig->variantTopology = PARSE_VARIANT_AXIS("topology", argv[++i], variantTopologyNames);
+        }else if(strcmp(argv[i], "--cull-mode") == 0 && i + 1 < argc){
+            pConfig->variantCullMode = PARSE_VARIANT_AXIS("cull mode", argv[++i], variantCullModeNames);
+        }else if(strcmp(argv[i], "--blend") == 0 && i + 1 < argc){
+            pConfig->variantBlendMode = PARSE_VARIANT_AXIS("blend mode", argv[++i], variantBlendModeNames);
+        }else if(strcmp(argv[i], "--brightness") == 0 && i + 1 < argc){
+            pConfig->variantBrightness = PARSE_VARIANT_AXIS("brightness", argv[++i], variantBrightnessNames);
+        }else if(strcmp(argv[i], "--dynamic-rendering") == 0){
+            pConfig->dynamicRendering = true;
+        }else if(strcmp(argv[i], "--init-threads") == 0 && i + 1 < argc){
+            pConfig->initThreads = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--shader-dir") == 0 && i + 1 < argc){
+            pConfig->shaderDir = argv[++i];
+        }else if(strcmp(argv[i], "--startup-trace") == 0 && i + 1 < argc){
+            pConfig->startupTracePath = argv[++i];
+        }else if(strcmp(argv[i], "--thread-sweep") == 0){
+            pConfig->threadSweep = true;
+        }else if(strcmp(argv[i], "--record-mode") == 0 && i + 1 < argc){
+            const char *mode = argv[++i];
+            if(strcmp(mode, "static") == 0){
+                pConfig->recordMode = RECORD_MODE_STATIC;
+            }else if(strcmp(mode, "dynamic") == 0){
+                pConfig->recordMode = RECORD_MODE_DYNAMIC;
+            }else{
+                printf("unknown record mode: %s\n", mode);
+                exit(1);
+            }
+        }else if(strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc){
+            pConfig->statsPath = argv[++i];
+        }else if(strcmp(argv[i], "--stats-format") == 0 && i + 1 < argc){
+            const char *format = argv[++i];
+            if(strcmp(format, "csv") == 0){
+                pConfig->statsFormat = STATS_FORMAT_CSV;
+            }else if(strcmp(format, "json") == 0){
+                pConfig->statsFormat = STATS_FORMAT_JSON;
+            }else{
+                printf("unknown stats format: %s\n", format);
+                exit(1);
+            }
+        }else if(strcmp(argv[i], "--capture") == 0 && i + 1 < argc){
+            pConfig->captureDir = argv[++i];
+        }else if(strcmp(argv[i], "--capture-interval") == 0 && i + 1 < argc){
+            pConfig->captureInterval = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--recreate-interval") == 0 && i + 1 < argc){
+            pConfig->recreateInterval = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--windows") == 0 && i + 1 < argc){
+            pConfig->windowCount = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc){
+            pConfig->statsInterval = (u32) strtoul(argv[++i], NULL, 10);
+        }else if(strcmp(argv[i], "--help") == 0){
+            printUsage(argv[0]);
+            exit(0);
+        }else{
+            printf("unknown option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if(pConfig->benchmarkFrames == 0){
+        printf("--frames must be greater than zero\n");
+        exit(1);
+    }
+
+    if(pConfig->instanceCount == 0){
+        printf("--instances must be greater than zero\n");
+        exit(1);
+    }
+
+    if(pConfig->instanceSweep && !pConfig->headless){
+        printf("--instance-sweep requires --headless\n");
+        exit(1);
+    }
+
+    if(pConfig->recordThreads < 1 || pConfig->recordThreads > MAX_RECORD_THREADS){
+        printf("--record-threads must be between 1 and %u\n", MAX_RECORD_THREADS);
+        exit(1);
+    }
+
+    if(pConfig->compileThreads < 1 || pConfig->compileThreads > MAX_COMPILE_THREADS){
+        printf("--compile-threads must be between 1 and %u\n", MAX_COMPILE_THREADS);
+        exit(1);
+    }
+
+    if(pConfig->initThreads < 1 || pConfig->initThreads > MAX_INIT_THREADS){
+        printf("--init-threads must be between 1 and %u\n", MAX_INIT_THREADS);
+        exit(1);
+    }
+
+    if(pConfig->threadSweep && (!pConfig->headless || pConfig->recordMode != RECORD_MODE_DYNAMIC ||
+        pConfig->instanceSweep)){
+        printf("--thread-sweep requires --headless and --record-mode dynamic, without --instance-sweep\n");
+        exit(1);
+    }
+
+    if(pConfig->animate && (pConfig->recordMode != RECORD_MODE_DYNAMIC || pConfig->instanceSweep)){
+        printf("--animate requires --record-mode dynamic, without --instance-sweep\n");
+        exit(1);
+    }
+
+    if(pConfig->captureInterval < 1){
+        printf("--capture-interval must be at least 1\n");
+        exit(1);
+    }
+
+    if(pConfig->framesInFlight < 1 || pConfig->framesInFlight > MAX_FRAMES_IN_FLIGHT){
+        printf("--frames-in-flight must be between 1 and %u\n", MAX_FRAMES_IN_FLIGHT);
+        exit(1);
+    }
+
+    if(pConfig->windowCount < 1 || pConfig->windowCount > MAX_WINDOWS){
+        printf("--windows must be between 1 and %u\n", MAX_WINDOWS);
+        exit(1);
+    }
+
+    // Secondaries are recorded for one window's render pass
+    if(pConfig->windowCount > 1 && (pConfig->recordThreads > 1 || pConfig->threadSweep)){
+        printf("--windows requires a single record thread, without --thread-sweep\n");
+        exit(1);
+    }
+}
+
+void initGlfw(App *pApp){
+    if(pApp->config.headless)
+        return;
+
     glfwInit();
+}
+
+void initWindow(App *pApp){
+    if(pApp->config.headless)
+        return;
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+
+    for(u32 i = 0; i < pApp->windowCount; i++){
+        AppWindow *pWindow = &pApp->windows[i];
+        char title[64];
+        if(pApp->windowCount == 1){
+            snprintf(title, sizeof(title), "%s", WIN_TITLE);
+        }else{
+            snprintf(title, sizeof(title), "%s %u", WIN_TITLE, i + 1);
+        }
+
+        pWindow->window = glfwCreateWindow(WIN_WIDTH, WIN_HEIGHT, title, NULL, NULL);
+
+        glfwSetWindowUserPointer(pWindow->window, pWindow);
+        glfwSetFramebufferSizeCallback(pWindow->window, framebufferResizeCallback);
+        glfwSetKeyCallback(pWindow->window, keyCallback);
+    }
+}
+
+// Stops once any of the windows is closed
+static bool anyWindowShouldClose(App *pApp){
+    for(u32 i = 0; i < pApp->windowCount; i++){
+        if(glfwWindowShouldClose(pApp->windows[i].window))
+            return true;
+    }
+    return false;
+}
+
+static void createInitialInstanceBuffer(App *pApp){
+    createInstanceBuffer(pApp, pApp->config.instanceCount);
+}
+
+static void createInitialRecordWorkers(App *pApp){
+    createRecordWorkers(pApp, pApp->config.recordThreads);
+}
+
+#define INIT_DEP(stage) ((uint64_t) 1 << (stage))
+
+// Dependencies name every stage whose handles are read. The command pool, the
+// graphics queue and the allocator are externally synchronized, so their users
+// are chained: swap chain (offscreen images) -> geometry -> instance buffer.
+static const InitStage initStages[INIT_STAGE_COUNT] = {
+    [INIT_GLFW] = {"initGlfw", initGlfw, 0, true},
+    [INIT_WINDOW] = {"initWindow", initWindow, INIT_DEP(INIT_GLFW), true},
+    [INIT_LOAD_SHADERS] = {"loadShaders", loadShaders, 0},
+    [INIT_LOAD_PIPELINE_CACHE_FILE] = {"loadPipelineCacheFile", loadPipelineCacheFile, 0},
+    [INIT_INSTANCE] = {"createInstance", createInstance, INIT_DEP(INIT_GLFW)},
+    [INIT_DEBUG_MESSENGER] = {"setupDebugMessenger", setupDebugMessenger, INIT_DEP(INIT_INSTANCE)},
+    [INIT_SURFACE] = {"createSurface", createSurface, INIT_DEP(INIT_INSTANCE) | INIT_DEP(INIT_WINDOW)},
+    [INIT_PHYSICAL_DEVICE] = {"pickPhysicalDevice", pickPhysicalDevice,
+        INIT_DEP(INIT_SURFACE) | INIT_DEP(INIT_DEBUG_MESSENGER)},
+    [INIT_LOGICAL_DEVICE] = {"createLogicalDevice", createLogicalDevice, INIT_DEP(INIT_PHYSICAL_DEVICE)},
+    [INIT_ALLOCATOR] = {"createAllocator", createAllocator, INIT_DEP(INIT_LOGICAL_DEVICE)},
+    // chooseSwapExtent asks GLFW for the framebuffer size
+    [INIT_SWAP_CHAIN] = {"createSwapChain", createSwapChain, INIT_DEP(INIT_ALLOCATOR), true},
+    [INIT_IMAGE_VIEWS] = {"createImageViews", createImageViews, INIT_DEP(INIT_SWAP_CHAIN)},
+    [INIT_RENDER_PASS] = {"createRenderPass", createRenderPass, INIT_DEP(INIT_SWAP_CHAIN)},
+    [INIT_PIPELINE_CACHE] = {"createPipelineCache", createPipelineCache,
+        INIT_DEP(INIT_LOGICAL_DEVICE) | INIT_DEP(INIT_LOAD_PIPELINE_CACHE_FILE)},
+    [INIT_DESCRIPTOR_HEAP] = {"createDescriptorHeap", createDescriptorHeap, INIT_DEP(INIT_LOGICAL_DEVICE)},
+    [INIT_GRAPHICS_PIPELINE] = {"createGraphicsPipeline", createGraphicsPipeline,
+        INIT_DEP(INIT_RENDER_PASS) | INIT_DEP(INIT_PIPELINE_CACHE) |
+        INIT_DEP(INIT_DESCRIPTOR_HEAP) | INIT_DEP(INIT_LOAD_SHADERS)},
+    [INIT_FRAMEBUFFERS] = {"createFramebuffers", createFramebuffers,
+        INIT_DEP(INIT_IMAGE_VIEWS) | INIT_DEP(INIT_RENDER_PASS)},
+    [INIT_COMMAND_POOL] = {"createCommandPool", createCommandPool, INIT_DEP(INIT_LOGICAL_DEVICE)},
+    [INIT_COMMAND_BUFFERS] = {"createCommandbuffers", createCommandbuffers, INIT_DEP(INIT_COMMAND_POOL)},
+    [INIT_GEOMETRY_BUFFERS] = {"createGeometryBuffers", createGeometryBuffers,
+        INIT_DEP(INIT_COMMAND_BUFFERS) | INIT_DEP(INIT_SWAP_CHAIN)},
+    [INIT_INSTANCE_BUFFER] = {"createInstanceBuffer", createInitialInstanceBuffer,
+        INIT_DEP(INIT_GEOMETRY_BUFFERS)},
+    [INIT_INSTANCE_DESCRIPTOR] = {"createInstanceDescriptor", createInstanceDescriptor,
+        INIT_DEP(INIT_INSTANCE_BUFFER) | INIT_DEP(INIT_DESCRIPTOR_HEAP)},
+    [INIT_COMPUTE_PIPELINE] = {"createComputePipeline", createComputePipeline,
+        INIT_DEP(INIT_DESCRIPTOR_HEAP) | INIT_DEP(INIT_PIPELINE_CACHE) | INIT_DEP(INIT_LOAD_SHADERS)},
+    // Takes heap slots and allocates, so it follows their other users
+    [INIT_ANIMATION] = {"createAnimation", createAnimation, INIT_DEP(INIT_INSTANCE_DESCRIPTOR)},
+    [INIT_TIMESTAMP_QUERIES] = {"createTimestampQueries", createTimestampQueries, INIT_DEP(INIT_LOGICAL_DEVICE)},
+    [INIT_RECORD_WORKERS] = {"createRecordWorkers", createInitialRecordWorkers, INIT_DEP(INIT_LOGICAL_DEVICE)},
+    // Transients come from the allocator, so it follows the animation buffers
+    [INIT_FRAME_GRAPH] = {"createFrameGraph", createFrameGraph, INIT_DEP(INIT_ANIMATION)},
+    [INIT_STATIC_COMMAND_BUFFERS] = {"createStaticCommandBuffers", createStaticCommandBuffers,
+        INIT_DEP(INIT_GRAPHICS_PIPELINE) | INIT_DEP(INIT_FRAMEBUFFERS) | INIT_DEP(INIT_INSTANCE_DESCRIPTOR) |
+        INIT_DEP(INIT_TIMESTAMP_QUERIES) | INIT_DEP(INIT_FRAME_GRAPH)},
+    // imageTimelineValues is sized by the swap chain
+    [INIT_SYNC_OBJECTS] = {"createSyncObjects", createSyncObjects, INIT_DEP(INIT_SWAP_CHAIN)},
+    // Last user of the command pool, needs the frame timeline
+    [INIT_CAPTURE] = {"createCapture", createCapture,
+        INIT_DEP(INIT_STATIC_COMMAND_BUFFERS) | INIT_DEP(INIT_SYNC_OBJECTS)},
+};
+
+// Every worker takes the first ready stage in table order, so with a single
+// worker the stages run exactly in the order above
+static void initStageWorker(void *pContext, u32 workerIndex){
+    InitScheduler *scheduler = (InitScheduler *) pContext;
+    const uint64_t allStages = INIT_DEP(INIT_STAGE_COUNT) - 1;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    while(scheduler->finished != allStages){
+        u32 next = INIT_STAGE_COUNT;
+        for(u32 i = 0; i < INIT_STAGE_COUNT; i++){
+            const InitStage *stage = &initStages[i];
+            if((scheduler->started & INIT_DEP(i)) || (stage->dependencies & ~scheduler->finished))
+                continue;
+            if(stage->mainThread && workerIndex != 0)
+                continue;
+            next = i;
+            break;
+        }
+
+        if(next == INIT_STAGE_COUNT){
+            pthread_cond_wait(&scheduler->changed, &scheduler->mutex);
+            continue;
+        }
+
+        scheduler->started |= INIT_DEP(next);
+        pthread_mutex_unlock(&scheduler->mutex);
+
+        double start = getTimeMs();
+        initStages[next].function(scheduler->pApp);
+
+        pthread_mutex_lock(&scheduler->mutex);
+        recordStartupPhase(scheduler->pApp, initStages[next].name, start, workerIndex);
+        scheduler->finished |= INIT_DEP(next);
+        pthread_cond_broadcast(&scheduler->changed);
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+// Creates the window and every Vulkan object, running independent stages
+// concurrently on --init-threads workers
+void initApp(App *pApp){
+    InitScheduler scheduler = {
+        .pApp = pApp,
+    };
+    pthread_mutex_init(&scheduler.mutex, NULL);
+    pthread_cond_init(&scheduler.changed, NULL);
+
+    WorkerPool pool;
+    workerPoolCreate(&pool, pApp->config.initThreads);
+    workerPoolRun(&pool, initStageWorker, &scheduler);
+    workerPoolDestroy(&pool);
+
+    pthread_mutex_destroy(&scheduler.mutex);
+    pthread_cond_destroy(&scheduler.changed);
+}
+
+// Called with the init scheduler's mutex held
+void recordStartupPhase(App *pApp, const char *name, double start, u32 thread){
+    if(pApp->startupPhaseCount == MAX_STARTUP_PHASES)
+        return;
 
-    pApp->window = glfwCreateWindow(WIN_WIDTH, WIN_HEIGHT, WIN_TITLE, NULL, NULL);
+    pApp->startupPhases[pApp->startupPhaseCount++] = (StartupPhase) {
+        .name = name,
+        .start = start - pApp->processStart,
+        .ms = getTimeMs() - start,
+        .thread = thread,
+    };
+}
 
-    glfwSetWindowUserPointer(pApp->window, pApp);
-    glfwSetFramebufferSizeCallback(pApp->window, framebufferResizeCallback);
+// Human readable breakdown once initApp returns. Phases overlap when init
+// runs on several threads, so their sum can exceed the wall time.
+void reportStartupPhases(App *pApp){
+    double total = 0.0;
+    for(u32 i = 0; i < pApp->startupPhaseCount; i++)
+        total += pApp->startupPhases[i].ms;
+
+    printf("startup: %.3f ms in %u phases on %u threads, %.3f ms since process start\n", total,
+        pApp->startupPhaseCount, pApp->config.initThreads, getTimeMs() - pApp->processStart);
+    for(u32 i = 0; i < pApp->startupPhaseCount; i++){
+        StartupPhase *phase = &pApp->startupPhases[i];
+        printf("  %-28s thread %u at %9.3f ms %9.3f ms %5.1f%%\n", phase->name, phase->thread,
+            phase->start, phase->ms, total > 0.0 ? phase->ms * 100.0 / total : 0.0);
+    }
 }
 
-void initVulkan(App *pApp){
-    createInstance(pApp);
-    setupDebugMessenger(pApp);
-    createSurface(pApp);
-    pickPhysicalDevice(pApp);
-    createLogicalDevice(pApp);
-    createSwapChain(pApp);
-    createImageViews(pApp);
-    createRenderPass(pApp);
-    createGraphicsPipeline(pApp);
-    createFramebuffers(pApp);
-    createCommandPool(pApp);
-    createCommandbuffers(pApp);
-    createSyncObjects(pApp);
+// Called once the first frame has been submitted. With --startup-trace, the
+// phases and time to first frame are written as a single JSON object.
+void finishStartupTrace(App *pApp){
+    double timeToFirstFrame = getTimeMs() - pApp->processStart;
+    printf("time to first frame: %.3f ms\n", timeToFirstFrame);
+
+    if(pApp->config.startupTracePath == NULL)
+        return;
+
+    FILE *file = fopen(pApp->config.startupTracePath, "w");
+    if(file == NULL){
+        printf("failed to open startup trace file %s\n", pApp->config.startupTracePath);
+        return;
+    }
+
+    fprintf(file, "{\"time_to_first_frame_ms\":%.4f,\"init_threads\":%u,\"phases\":[",
+        timeToFirstFrame, pApp->config.initThreads);
+    for(u32 i = 0; i < pApp->startupPhaseCount; i++){
+        StartupPhase *phase = &pApp->startupPhases[i];
+        fprintf(file, "%s{\"name\":\"%s\",\"thread\":%u,\"start_ms\":%.4f,\"ms\":%.4f}",
+            i == 0 ? "" : ",", phase->name, phase->thread, phase->start, phase->ms);
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
 }
 
 void mainloop(App *pApp){
-    while(!glfwWindowShouldClose(pApp->window)){
+    while(!anyWindowShouldClose(pApp)){
         glfwPollEvents();
         drawFrame(pApp);
     }
@@ -74,20 +616,69 @@ void mainloop(App *pApp){
 
 void cleanup(App *pApp){
 
-    cleanupSwapChain(pApp);
+    dumpFrameStats(pApp);
+    if(pApp->statsFile != NULL && pApp->statsFile != stdout){
+        fclose(pApp->statsFile);
+    }
+
+    destroyCapture(pApp);
+
+    for(u32 i = 0; i < pApp->windowCount; i++){
+        destroyRetiredSwapChains(pApp, &pApp->windows[i], true);
+        cleanupSwapChain(pApp, &pApp->windows[i]);
+    }
 
-    vkDestroyPipeline(pApp->device, pApp->graphicsPipeline, NULL);
+    destroyPipelineVariants(pApp);
     vkDestroyPipelineLayout(pApp->device, pApp->pipelineLayout, NULL);
 
-    vkDestroyRenderPass(pApp->device, pApp->renderPass, NULL);
+    savePipelineCache(pApp);
+    vkDestroyPipelineCache(pApp->device, pApp->pipelineCache, NULL);
 
-    for(u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
-        vkDestroySemaphore(pApp->device, pApp->imageAvailableSemaphores[i], NULL);
+    vkDestroyRenderPass(pApp->device, pApp->renderPass, NULL);
+    if(pApp->config.dynamicRendering)
+        renderGraphDestroy(&pApp->frameGraph);
+
+    destroyInstanceBuffer(pApp);
+    destroyAnimation(pApp);
+    bindlessHeapDestroy(&pApp->descriptorHeap);
+
+    vkDestroyBuffer(pApp->device, pApp->indexBuffer, NULL);
+    gpuFree(&pApp->allocator, &pApp->indexAllocation);
+    vkDestroyBuffer(pApp->device, pApp->vertexBuffer, NULL);
+    gpuFree(&pApp->allocator, &pApp->vertexAllocation);
+
+    for(u32 i = 0; i < pApp->windowCount; i++){
+        AppWindow *pWindow = &pApp->windows[i];
+        for(u32 j = 0; j < pApp->config.framesInFlight; j++){
+            vkDestroySemaphore(pApp->device, pWindow->imageAvailableSemaphores[j], NULL);
+        }
+        free(pWindow->imageAvailableSemaphores);
+        free(pWindow->imageTimelineValues);
+    }
+    for(u32 i = 0; i < pApp->config.framesInFlight; i++){
         vkDestroySemaphore(pApp->device, pApp->renderFinishedSemaphores[i], NULL);
-        vkDestroyFence(pApp->device, pApp->inFlightFences[i], NULL);
     }
+    free(pApp->renderFinishedSemaphores);
+
+    vkDestroySemaphore(pApp->device, pApp->frameTimeline, NULL);
+
+    freeStaticCommandBuffers(pApp);
+    destroyRecordWorkers(pApp);
 
     vkDestroyCommandPool(pApp->device, pApp->commandPool, NULL);
+    if(pApp->transferCommandPool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(pApp->device, pApp->transferCommandPool, NULL);
+
+    if(pApp->gpuTimingSupported){
+        vkDestroyQueryPool(pApp->device, pApp->timestampQueryPool, NULL);
+    }
+
+    gpuAllocatorWriteStats(&pApp->allocator, stdout);
+    for(u32 i = 0; i < pApp->config.framesInFlight; i++){
+        gpuLinearArenaDestroy(&pApp->allocator, &pApp->frameArenas[i]);
+    }
+    free(pApp->frameArenas);
+    gpuAllocatorDestroy(&pApp->allocator);
 
     vkDestroyDevice(pApp->device, NULL);
     
@@ -95,13 +686,18 @@ void cleanup(App *pApp){
         DestroyDebugUtilsMessengerEXT(pApp->instance, pApp->debugMessenger, NULL);
     }
 
-    vkDestroySurfaceKHR(pApp->instance , pApp->surface, NULL);
+    if(!pApp->config.headless){
+        for(u32 i = 0; i < pApp->windowCount; i++)
+            vkDestroySurfaceKHR(pApp->instance , pApp->windows[i].surface, NULL);
+    }
 
     vkDestroyInstance(pApp->instance, NULL);
 
-    glfwDestroyWindow(pApp->window);
-
-    glfwTerminate();
+    if(!pApp->config.headless){
+        for(u32 i = 0; i < pApp->windowCount; i++)
+            glfwDestroyWindow(pApp->windows[i].window);
+        glfwTerminate();
+    }
 }
 
 void createInstance(App *pApp){
@@ -117,14 +713,17 @@ void createInstance(App *pApp){
         .applicationVersion = VK_MAKE_VERSION(1,0,0),
         .pEngineName = "No Engine",
         .engineVersion = VK_MAKE_VERSION(1,0,0),
-        .apiVersion = VK_API_VERSION_1_0,
+        .apiVersion = VK_API_VERSION_1_2,
         .pNext = NULL
     };
 
     u32 glfwExtensionCount = 0;
-    const char **availableGlfwExtensions;
+    const char **availableGlfwExtensions = NULL;
 
-    availableGlfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    // Headless rendering needs no surface extensions
+    if(!pApp->config.headless){
+        availableGlfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    }
 
     const char **glfwExtensions = (const char **) malloc(
         sizeof(char *) * (glfwExtensionCount + 1)
@@ -305,7 +904,7 @@ void pickPhysicalDevice(App *pApp) {
     VkPhysicalDevice device = VK_NULL_HANDLE;;
 
     for(int i = 0; i < deviceCount; i++){
-        u32 score = rateDeviceSuitability(devices[i], pApp->surface);
+        u32 score = rateDeviceSuitability(devices[i], pApp->windows[0].surface);
         if(score > deviceScore){
             deviceScore = score;
             device = devices[i];
@@ -319,7 +918,7 @@ void pickPhysicalDevice(App *pApp) {
     pApp->physicalDevice = device;
     printf("GPU selected\n");
 
-    pApp->queueFamilyIndices = findQueueFamilies(device, pApp->surface);
+    pApp->queueFamilyIndices = findQueueFamilies(device, pApp->windows[0].surface);
     free(devices);
 }
 
@@ -330,6 +929,34 @@ u32 rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface){
     VkPhysicalDeviceFeatures deviceFeatures;
     vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
 
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &vulkan12Features,
+    };
+
+    // Frame pacing is built on timeline semaphores
+    if(deviceProperties.apiVersion < VK_API_VERSION_1_2){
+        printf("%s does not support Vulkan 1.2!\n", deviceProperties.deviceName);
+        return 0;
+    }
+    vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+    if(!vulkan12Features.timelineSemaphore){
+        printf("%s does not support timeline semaphores!\n", deviceProperties.deviceName);
+        return 0;
+    }
+    // Shaders index the bindless descriptor heap with a push constant
+    if(!deviceFeatures.shaderStorageBufferArrayDynamicIndexing ||
+        !vulkan12Features.runtimeDescriptorArray || !vulkan12Features.descriptorBindingPartiallyBound ||
+        !vulkan12Features.descriptorBindingUpdateUnusedWhilePending ||
+        !vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind ||
+        !vulkan12Features.descriptorBindingSampledImageUpdateAfterBind){
+        printf("%s does not support descriptor indexing!\n", deviceProperties.deviceName);
+        return 0;
+    }
+
     u32 score = 0;
 
     // Discrete GPUs have a significant performance advantage
@@ -351,6 +978,11 @@ u32 rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface){
         return 0;
     }
 
+    // Offscreen rendering doesn't present, so there is no swap chain to check
+    if(surface == VK_NULL_HANDLE){
+        return score;
+    }
+
     bool extensionsSupported = checkDeviceExtensionSupport(device);
     if(!extensionsSupported){
         printf("required device extensions is not supported!\n");
@@ -359,7 +991,9 @@ u32 rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface){
 
     bool swapChainAdequate = false;
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device, surface);
-    if(swapChainSupport.formatCount == 0 || swapChainSupport.presentModeCount == 0){
+    swapChainAdequate = swapChainSupport.formatCount != 0 && swapChainSupport.presentModeCount != 0;
+    freeSwapChainSupportDetails(&swapChainSupport);
+    if(!swapChainAdequate){
         printf("swap chain not adequately supported!\n");
         return 0;
     }
@@ -377,20 +1011,47 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surfa
         sizeof(VkQueueFamilyProperties) * queueFamilyCount);
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilyProperties);
 
+    bool transferOnly = false;
     for(int i = 0; i < queueFamilyCount; i++){
-        if(queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT){
+        VkQueueFlags flags = queueFamilyProperties[i].queueFlags;
+        if((flags & VK_QUEUE_GRAPHICS_BIT) && !indices.isGraphicsFamilySet){
             indices.graphicsFamily = i;
             indices.isGraphicsFamilySet = true;
         }
 
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-        if(presentSupport){
+        if(surface == VK_NULL_HANDLE){
+            // Headless: nothing is presented, the graphics queue does all the work
+            presentSupport = indices.isGraphicsFamilySet && indices.graphicsFamily == i;
+        }else{
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        }
+        // Presenting from the graphics family avoids a second queue
+        if(presentSupport && (!indices.isPresentFamilySet ||
+            (indices.isGraphicsFamilySet && indices.graphicsFamily == i))){
             indices.presentFamily = i;
             indices.isPresentFamilySet = true;
         }
-        if(indices.isGraphicsFamilySet && indices.isPresentFamilySet)
-            break;
+
+        if(flags & VK_QUEUE_GRAPHICS_BIT)
+            continue;
+
+        if((flags & VK_QUEUE_COMPUTE_BIT) && !indices.isComputeFamilySet){
+            indices.computeFamily = i;
+            indices.isComputeFamilySet = true;
+        }
+        // Compute families support transfers too, but a transfer-only family is usually a copy engine
+        bool isTransferOnly = !(flags & VK_QUEUE_COMPUTE_BIT) && (flags & VK_QUEUE_TRANSFER_BIT);
+        if(isTransferOnly && !transferOnly){
+            indices.transferFamily = i;
+            indices.isTransferFamilySet = true;
+            transferOnly = true;
+        }
+    }
+
+    if(!indices.isTransferFamilySet && indices.isComputeFamilySet){
+        indices.transferFamily = indices.computeFamily;
+        indices.isTransferFamilySet = true;
     }
 
 
@@ -398,45 +1059,251 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surfa
     return indices;
 }
 
-void createLogicalDevice(App *pApp){
-    QueueFamilyIndices indices = findQueueFamilies(pApp->physicalDevice, pApp->surface);
-
-    float queuePriority = 1.0f;
-
-    VkDeviceQueueCreateInfo queueCreateInfos[2];
-    u32 queueCreateInfoCount = 0;
+// Adds a queue on family to the create infos and returns its index in the
+// family. Once the family has no queue left, the last one is shared.
+static u32 requestQueue(VkDeviceQueueCreateInfo *queueCreateInfos, u32 *pQueueCreateInfoCount,
+    const VkQueueFamilyProperties *queueFamilyProperties, u32 family){
+    static const float queuePriorities[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+    for(u32 i = 0; i < *pQueueCreateInfoCount; i++){
+        VkDeviceQueueCreateInfo *info = &queueCreateInfos[i];
+        if(info->queueFamilyIndex != family)
+            continue;
+        if(info->queueCount == queueFamilyProperties[family].queueCount)
+            return info->queueCount - 1;
+        return info->queueCount++;
+    }
 
-    // Graphics Queue
-    VkDeviceQueueCreateInfo graphicsQueueCreateInfo = {
+    queueCreateInfos[(*pQueueCreateInfoCount)++] = (VkDeviceQueueCreateInfo) {
         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = indices.graphicsFamily,
+        .queueFamilyIndex = family,
         .queueCount = 1,
-        .pQueuePriorities = &queuePriority
+        .pQueuePriorities = queuePriorities,
     };
+    return 0;
+}
 
-    queueCreateInfos[queueCreateInfoCount++] = graphicsQueueCreateInfo;
+static bool deviceExtensionAvailable(VkPhysicalDevice device, const char *name){
+    u32 extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, NULL);
 
-    if(indices.presentFamily != indices.graphicsFamily){
-        VkDeviceQueueCreateInfo presentQueueCreateInfo = {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = indices.presentFamily,
-            .queueCount = 1,
-            .pQueuePriorities = &queuePriority
+    VkExtensionProperties *availableExtensions = (VkExtensionProperties *) malloc(
+        sizeof(VkExtensionProperties) * extensionCount
+    );
+    vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, availableExtensions);
+
+    bool extensionFound = false;
+    for(u32 i = 0; i < extensionCount; i++){
+        if(strcmp(availableExtensions[i].extensionName, name) == 0){
+            extensionFound = true;
+            break;
+        }
+    }
+    free(availableExtensions);
+    return extensionFound;
+}
+
+static bool dynamicRenderingSupported(VkPhysicalDevice device){
+    if(!deviceExtensionAvailable(device, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME))
+        return false;
+
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+    };
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &dynamicRenderingFeatures,
+    };
+    vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+    return dynamicRenderingFeatures.dynamicRendering;
+}
+
+static bool synchronization2Supported(VkPhysicalDevice device){
+    if(!deviceExtensionAvailable(device, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME))
+        return false;
+
+    VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
+    };
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &synchronization2Features,
+    };
+    vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+    return synchronization2Features.synchronization2;
+}
+
+// Fills the flags of pApp->dynamicState, every axis without support stays baked.
+// VK_EXT_extended_dynamic_state2 is not queried: depth bias, primitive restart
+// and rasterizer discard are the same in every variant, so nothing would move.
+static void queryExtendedDynamicState(App *pApp){
+    ExtendedDynamicState *state = &pApp->dynamicState;
+    if(pApp->config.bakedVariants)
+        return;
+
+    bool basic = deviceExtensionAvailable(pApp->physicalDevice, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+    bool blend = deviceExtensionAvailable(pApp->physicalDevice, VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT basicFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+    };
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT blendFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT,
+        .pNext = basic ? &basicFeatures : NULL,
+    };
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = blend ? (void *) &blendFeatures : (basic ? (void *) &basicFeatures : NULL),
+    };
+    vkGetPhysicalDeviceFeatures2(pApp->physicalDevice, &deviceFeatures2);
+
+    state->cullTopology = basic && basicFeatures.extendedDynamicState;
+    state->blend = blend && blendFeatures.extendedDynamicState3ColorBlendEnable &&
+        blendFeatures.extendedDynamicState3ColorBlendEquation;
+
+    // The property only holds once createLogicalDevice enables the extension,
+    // which it does for blend
+    if(state->blend){
+        VkPhysicalDeviceExtendedDynamicState3PropertiesEXT blendProperties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_PROPERTIES_EXT,
+        };
+        VkPhysicalDeviceProperties2 deviceProperties2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &blendProperties,
         };
+        vkGetPhysicalDeviceProperties2(pApp->physicalDevice, &deviceProperties2);
+        state->topologyUnrestricted = blendProperties.dynamicPrimitiveTopologyUnrestricted;
+    }
+}
+
+void createLogicalDevice(App *pApp){
+    QueueFamilyIndices indices = findQueueFamilies(pApp->physicalDevice, pApp->windows[0].surface);
+
+    u32 queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(pApp->physicalDevice, &queueFamilyCount, NULL);
+    VkQueueFamilyProperties *queueFamilyProperties = malloc(
+        sizeof(VkQueueFamilyProperties) * queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(pApp->physicalDevice, &queueFamilyCount, queueFamilyProperties);
+
+    // Graphics and present share a queue when they share a family. Transfer and
+    // compute may share a family too, then each gets its own queue if there are two.
+    VkDeviceQueueCreateInfo queueCreateInfos[4];
+    u32 queueCreateInfoCount = 0;
 
-        queueCreateInfos[queueCreateInfoCount++] = presentQueueCreateInfo;
+    u32 graphicsQueueIndex = requestQueue(queueCreateInfos, &queueCreateInfoCount,
+        queueFamilyProperties, indices.graphicsFamily);
+    u32 presentQueueIndex = graphicsQueueIndex;
+    if(indices.presentFamily != indices.graphicsFamily){
+        presentQueueIndex = requestQueue(queueCreateInfos, &queueCreateInfoCount,
+            queueFamilyProperties, indices.presentFamily);
+    }
+
+    u32 transferQueueIndex = 0;
+    if(indices.isTransferFamilySet){
+        transferQueueIndex = requestQueue(queueCreateInfos, &queueCreateInfoCount,
+            queueFamilyProperties, indices.transferFamily);
+    }
+    u32 computeQueueIndex = 0;
+    if(indices.isComputeFamilySet){
+        computeQueueIndex = requestQueue(queueCreateInfos, &queueCreateInfoCount,
+            queueFamilyProperties, indices.computeFamily);
     }
+    free(queueFamilyProperties);
 
     VkPhysicalDeviceFeatures deviceFeatures = {};
     vkGetPhysicalDeviceFeatures(pApp->physicalDevice, &deviceFeatures);
+    // Checked in rateDeviceSuitability. The image array will need
+    // shaderSampledImageArrayDynamicIndexing once a shader indexes it.
+    deviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+
+    // Falls back to the render pass when the extension or its feature is missing
+    if(pApp->config.dynamicRendering && !dynamicRenderingSupported(pApp->physicalDevice)){
+        printf("dynamic rendering is not supported, using a render pass\n");
+        pApp->config.dynamicRendering = false;
+    }
+
+    queryExtendedDynamicState(pApp);
+    const ExtendedDynamicState *dynamicState = &pApp->dynamicState;
+
+    // Only the frame graph places barriers with it, vkCmdPipelineBarrier otherwise
+    bool synchronization2 = pApp->config.dynamicRendering && synchronization2Supported(pApp->physicalDevice);
+
+    // Optional feature structs are pushed onto the front of the chain
+    void *featureChain = NULL;
+
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+        .pNext = featureChain,
+        .dynamicRendering = VK_TRUE,
+    };
+    if(pApp->config.dynamicRendering)
+        featureChain = &dynamicRenderingFeatures;
+
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+        .pNext = featureChain,
+        .extendedDynamicState = VK_TRUE,
+    };
+    if(dynamicState->cullTopology)
+        featureChain = &extendedDynamicStateFeatures;
+
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extendedDynamicState3Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT,
+        .pNext = featureChain,
+        .extendedDynamicState3ColorBlendEnable = VK_TRUE,
+        .extendedDynamicState3ColorBlendEquation = VK_TRUE,
+    };
+    if(dynamicState->blend)
+        featureChain = &extendedDynamicState3Features;
+
+    VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
+        .pNext = featureChain,
+        .synchronization2 = VK_TRUE,
+    };
+    if(synchronization2)
+        featureChain = &synchronization2Features;
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = featureChain,
+        .timelineSemaphore = VK_TRUE,
+        .runtimeDescriptorArray = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
+        .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+        .descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+    };
+
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &vulkan12Features,
+        .features = deviceFeatures,
+    };
+
+    const char *enabledExtensions[5];
+    u32 enabledExtensionCount = 0;
+    if(!pApp->config.headless){
+        for(u32 i = 0; i < deviceExtensionsCount; i++)
+            enabledExtensions[enabledExtensionCount++] = deviceExtensions[i];
+    }
+    if(pApp->config.dynamicRendering)
+        enabledExtensions[enabledExtensionCount++] = VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME;
+    if(dynamicState->cullTopology)
+        enabledExtensions[enabledExtensionCount++] = VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME;
+    if(dynamicState->blend)
+        enabledExtensions[enabledExtensionCount++] = VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME;
+    if(synchronization2)
+        enabledExtensions[enabledExtensionCount++] = VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME;
 
     VkDeviceCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &deviceFeatures2,
         .pQueueCreateInfos = queueCreateInfos,
         .queueCreateInfoCount = queueCreateInfoCount,
-        .pEnabledFeatures = &deviceFeatures,
-        .enabledExtensionCount = deviceExtensionsCount,
-        .ppEnabledExtensionNames = deviceExtensions,
+        .pEnabledFeatures = NULL, // passed through deviceFeatures2
+        .enabledExtensionCount = enabledExtensionCount,
+        .ppEnabledExtensionNames = enabledExtensions,
     };
 
     if(enableValidationLayers){
@@ -452,17 +1319,85 @@ void createLogicalDevice(App *pApp){
     }
 
 
-    vkGetDeviceQueue(pApp->device, indices.graphicsFamily, 0, &pApp->graphicsQueue);
+    vkGetDeviceQueue(pApp->device, indices.graphicsFamily, graphicsQueueIndex, &pApp->graphicsQueue);
+
+    vkGetDeviceQueue(pApp->device, indices.presentFamily, presentQueueIndex, &pApp->presentQueue);
+
+    if(indices.isTransferFamilySet)
+        vkGetDeviceQueue(pApp->device, indices.transferFamily, transferQueueIndex, &pApp->transferQueue);
+    if(indices.isComputeFamilySet)
+        vkGetDeviceQueue(pApp->device, indices.computeFamily, computeQueueIndex, &pApp->computeQueue);
+
+    // Extension commands are not exported by a 1.2 loader
+    if(pApp->config.dynamicRendering){
+        pApp->cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)
+            vkGetDeviceProcAddr(pApp->device, "vkCmdBeginRenderingKHR");
+        pApp->cmdEndRendering = (PFN_vkCmdEndRenderingKHR)
+            vkGetDeviceProcAddr(pApp->device, "vkCmdEndRenderingKHR");
+        if(pApp->cmdBeginRendering == NULL || pApp->cmdEndRendering == NULL){
+            printf("failed to load dynamic rendering commands!\n");
+            exit(4);
+        }
+    }
+    statsSetLabel(&pApp->stats, "rendering", pApp->config.dynamicRendering ? "dynamic" : "render_pass");
+
+    if(synchronization2){
+        pApp->cmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2KHR)
+            vkGetDeviceProcAddr(pApp->device, "vkCmdPipelineBarrier2KHR");
+        if(pApp->cmdPipelineBarrier2 == NULL){
+            printf("failed to load synchronization2 commands!\n");
+            exit(4);
+        }
+    }
 
-    vkGetDeviceQueue(pApp->device, indices.presentFamily, 0, &pApp->presentQueue);
+    ExtendedDynamicState *state = &pApp->dynamicState;
+    if(state->cullTopology){
+        state->setCullMode = (PFN_vkCmdSetCullModeEXT)
+            vkGetDeviceProcAddr(pApp->device, "vkCmdSetCullModeEXT");
+        state->setFrontFace = (PFN_vkCmdSetFrontFaceEXT)
+            vkGetDeviceProcAddr(pApp->device, "vkCmdSetFrontFaceEXT");
+        state->setPrimitiveTopology = (PFN_vkCmdSetPrimitiveTopologyEXT)
+            vkGetDeviceProcAddr(pApp->device, "vkCmdSetPrimitiveTopologyEXT");
+        if(state->setCullMode == NULL || state->setFrontFace == NULL || state->setPrimitiveTopology == NULL){
+            printf("failed to load extended dynamic state commands!\n");
+            exit(4);
+        }
+    }
+    if(state->blend){
+        state->setColorBlendEnable = (PFN_vkCmdSetColorBlendEnableEXT)
+            vkGetDeviceProcAddr(pApp->device, "vkCmdSetColorBlendEnableEXT");
+        state->setColorBlendEquation = (PFN_vkCmdSetColorBlendEquationEXT)
+            vkGetDeviceProcAddr(pApp->device, "vkCmdSetColorBlendEquationEXT");
+        if(state->setColorBlendEnable == NULL || state->setColorBlendEquation == NULL){
+            printf("failed to load extended dynamic state 3 commands!\n");
+            exit(4);
+        }
+    }
+    printf("dynamic pipeline state: cull mode and topology %s, blend %s\n",
+        state->cullTopology ? "yes" : "no", state->blend ? "yes" : "no");
+
+    printf("queue families: graphics %u, present %u", indices.graphicsFamily, indices.presentFamily);
+    if(indices.isTransferFamilySet)
+        printf(", transfer %u", indices.transferFamily);
+    if(indices.isComputeFamilySet)
+        printf(", compute %u", indices.computeFamily);
+    printf("\n");
 }
 
 void createSurface(App *pApp){
-    if(glfwCreateWindowSurface(pApp->instance, pApp->window, 
-        NULL, &pApp->surface) != VK_SUCCESS){
-            printf("failed to create window sufrace!\n");
-            exit(5);
+    for(u32 i = 0; i < pApp->windowCount; i++){
+        AppWindow *pWindow = &pApp->windows[i];
+        if(pApp->config.headless){
+            pWindow->surface = VK_NULL_HANDLE;
+            continue;
         }
+
+        if(glfwCreateWindowSurface(pApp->instance, pWindow->window, 
+            NULL, &pWindow->surface) != VK_SUCCESS){
+                printf("failed to create window sufrace!\n");
+                exit(5);
+            }
+    }
 }
 
 bool checkDeviceExtensionSupport(VkPhysicalDevice device){
@@ -499,11 +1434,11 @@ SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurface
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
 
     u32 formatCount;
-    vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &formatCount, NULL);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, NULL);
     details.formatCount = formatCount;
 
     if(formatCount != 0){
-        details.formats = details.formats = (VkSurfaceFormatKHR *) malloc(
+        details.formats = (VkSurfaceFormatKHR *) malloc(
             sizeof(VkSurfaceFormatKHR) * formatCount);
         vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats);
     }
@@ -521,6 +1456,13 @@ SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurface
     return details;
 }
 
+void freeSwapChainSupportDetails(SwapChainSupportDetails *pDetails){
+    free(pDetails->formats);
+    free(pDetails->presentModes);
+    pDetails->formats = NULL;
+    pDetails->presentModes = NULL;
+}
+
 
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(u32 formatCount,VkSurfaceFormatKHR *availableFormats) {
     for(int i = 0; i < formatCount; i++){
@@ -533,15 +1475,40 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(u32 formatCount,VkSurfaceFormatKHR *a
     return availableFormats[0];
 }
 
-VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *availablePresentModes) {
-    for(int i = 0; i < presentModeCount; i++){
-        if(availablePresentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR){
-            return availablePresentModes[i];
+VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *availablePresentModes,
+    PresentPolicy policy) {
+    const VkPresentModeKHR *preferred = presentPolicyFallbacks[policy];
+
+    for(int p = 0; p < 3; p++){
+        for(int i = 0; i < presentModeCount; i++){
+            if(availablePresentModes[i] == preferred[p]){
+                return availablePresentModes[i];
+            }
         }
     }
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+bool parsePresentPolicy(const char *name, PresentPolicy *pPolicy){
+    for(int i = 0; i < PRESENT_POLICY_COUNT; i++){
+        if(strcmp(name, presentPolicyNames[i]) == 0){
+            *pPolicy = (PresentPolicy) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *presentModeName(VkPresentModeKHR presentMode){
+    switch(presentMode){
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+        case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo_relaxed";
+        default: return "other";
+    }
+}
+
 u32 clamp_u32(u32 num, u32 min, u32 max){
     if(num < min) return min;
     if(num > max) return max;
@@ -563,26 +1530,91 @@ VkExtent2D chooseSwapExtent(GLFWwindow *window, VkSurfaceCapabilitiesKHR capabil
     return actualExtent;
 }
 
-void createSwapChain(App *pApp){
-    SwapChainSupportDetails swapChainSupport = querySwapChainSupport(pApp->physicalDevice, pApp->surface);
+static void freeSwapChainArrays(SwapChainArrays *pArrays){
+    free(pArrays->images);
+    free(pArrays->imageViews);
+    free(pArrays->framebuffers);
+    free(pArrays->imageAllocations);
+    *pArrays = (SwapChainArrays) {0};
+}
 
-    VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formatCount, 
-        swapChainSupport.formats);
+// Points the swap chain arrays at storage for imageCount images. The spare set
+// is used when its count matches, so recreation at a new size doesn't allocate.
+static void acquireSwapChainArrays(App *pApp, AppWindow *pWindow, u32 imageCount){
+    SwapChainArrays *spare = &pWindow->spareSwapChainArrays;
+
+    if(spare->images == NULL || spare->imageCount != imageCount){
+        freeSwapChainArrays(spare);
+        spare->images = (VkImage *) malloc(sizeof(VkImage) * imageCount);
+        spare->imageViews = (VkImageView *) malloc(sizeof(VkImageView) * imageCount);
+        if(!pApp->config.dynamicRendering)
+            spare->framebuffers = (VkFramebuffer *) malloc(sizeof(VkFramebuffer) * imageCount);
+        if(pApp->config.headless)
+            spare->imageAllocations = (GpuAllocation *) malloc(sizeof(GpuAllocation) * imageCount);
+        spare->imageCount = imageCount;
+    }
 
-    VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModeCount,
-    swapChainSupport.presentModes);
+    pWindow->swapChainImages = spare->images;
+    pWindow->swapChainImageViews = spare->imageViews;
+    pWindow->swapChainFramebuffers = spare->framebuffers;
+    pWindow->offscreenImageAllocations = spare->imageAllocations;
+    *spare = (SwapChainArrays) {0};
+}
 
-    VkExtent2D extent = chooseSwapExtent(pApp->window, swapChainSupport.capabilities);
+// Arrays of a destroyed swap chain become the spare set, one set is kept
+static void recycleSwapChainArrays(AppWindow *pWindow, SwapChainArrays *pArrays){
+    if(pWindow->spareSwapChainArrays.images == NULL){
+        pWindow->spareSwapChainArrays = *pArrays;
+        *pArrays = (SwapChainArrays) {0};
+    }else{
+        freeSwapChainArrays(pArrays);
+    }
+}
 
-    u32 imageCount = swapChainSupport.capabilities.minImageCount + 1;
-    if(swapChainSupport.capabilities.minImageCount > 0 && 
-        imageCount > swapChainSupport.capabilities.minImageCount){
-            imageCount = swapChainSupport.capabilities.minImageCount;
-        }
+void createSwapChain(App *pApp){
+    for(u32 i = 0; i < pApp->windowCount; i++)
+        createWindowSwapChain(pApp, &pApp->windows[i]);
+}
+
+void createWindowSwapChain(App *pApp, AppWindow *pWindow){
+    if(pApp->config.headless){
+        createOffscreenImages(pApp, pWindow);
+        pWindow->imagesCopyable = true;
+        return;
+    }
+
+    // Device and queue families were picked for the first window's surface
+    if(pWindow->index > 0){
+        VkBool32 presentSupport = VK_FALSE;
+        vkGetPhysicalDeviceSurfaceSupportKHR(pApp->physicalDevice, pApp->queueFamilyIndices.presentFamily,
+            pWindow->surface, &presentSupport);
+        if(!presentSupport){
+            printf("window %u can't be presented from queue family %u\n", pWindow->index,
+                pApp->queueFamilyIndices.presentFamily);
+            exit(6);
+        }
+    }
+
+    SwapChainSupportDetails swapChainSupport = querySwapChainSupport(pApp->physicalDevice, pWindow->surface);
+
+    VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formatCount, 
+        swapChainSupport.formats);
+
+    VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModeCount,
+    swapChainSupport.presentModes, pApp->config.presentPolicy);
+
+    VkExtent2D extent = chooseSwapExtent(pWindow->window, swapChainSupport.capabilities);
+
+    // One image more than the minimum so mailbox/immediate never wait on the presentation engine
+    u32 imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    if(swapChainSupport.capabilities.maxImageCount > 0 && 
+        imageCount > swapChainSupport.capabilities.maxImageCount){
+            imageCount = swapChainSupport.capabilities.maxImageCount;
+        }
 
     VkSwapchainCreateInfoKHR createInfo = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-        .surface = pApp->surface,
+        .surface = pWindow->surface,
         .minImageCount = imageCount,
         .imageFormat = surfaceFormat.format,
         .imageColorSpace = surfaceFormat.colorSpace,
@@ -593,10 +1625,22 @@ void createSwapChain(App *pApp){
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
         .presentMode = presentMode,
         .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE,
+        .oldSwapchain = pWindow->swapChain, // VK_NULL_HANDLE on first creation, retired afterwards
     };
 
-    QueueFamilyIndices indices = findQueueFamilies(pApp->physicalDevice, pApp->surface);
+    // Frame capture copies straight out of the swap chain images. Without the
+    // usage it skips frames until a recreated swap chain supports it again.
+    pWindow->imagesCopyable = false;
+    if(pApp->config.captureDir != NULL){
+        if(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT){
+            createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            pWindow->imagesCopyable = true;
+        }else if(pWindow->index == 0){
+            printf("swap chain images can't be copied from, frame capture paused\n");
+        }
+    }
+
+    QueueFamilyIndices indices = pApp->queueFamilyIndices;
     u32 queueFamilyIndices[] = { indices.graphicsFamily, indices.presentFamily};
 
     if (indices.graphicsFamily != indices.presentFamily) {
@@ -609,29 +1653,114 @@ void createSwapChain(App *pApp){
         createInfo.pQueueFamilyIndices = NULL; // Optional
     }
 
-    if (vkCreateSwapchainKHR(pApp->device, &createInfo, NULL, &pApp->swapChain) != VK_SUCCESS) {
+    // The render pass and pipelines are built for one format, shared by every window
+    if(pWindow->index > 0 && surfaceFormat.format != pApp->swapChainImageFormat){
+        printf("window %u has surface format %d, window 0 has %d\n", pWindow->index,
+            surfaceFormat.format, pApp->swapChainImageFormat);
+        exit(6);
+    }
+
+    if (vkCreateSwapchainKHR(pApp->device, &createInfo, NULL, &pWindow->swapChain) != VK_SUCCESS) {
         printf("failed to create swap chain!");
         exit(6);
     }
 
-    vkGetSwapchainImagesKHR(pApp->device, pApp->swapChain, &imageCount, NULL);
-    pApp->swapChainImages = (VkImage *) malloc(sizeof(VkImage) *imageCount);
-    vkGetSwapchainImagesKHR(pApp->device, pApp->swapChain, &imageCount, pApp->swapChainImages);
+    vkGetSwapchainImagesKHR(pApp->device, pWindow->swapChain, &imageCount, NULL);
+    acquireSwapChainArrays(pApp, pWindow, imageCount);
+    vkGetSwapchainImagesKHR(pApp->device, pWindow->swapChain, &imageCount, pWindow->swapChainImages);
     
     pApp->swapChainImageFormat = surfaceFormat.format;
-    pApp->swapChainExtent = extent;
-    pApp->swapChainImageCount = imageCount;
+    pWindow->swapChainExtent = extent;
+    pWindow->swapChainImageCount = imageCount;
+
+    if(presentMode != pWindow->presentMode && pWindow->index == 0){
+        printf("present mode: %s (policy %s)\n", presentModeName(presentMode),
+            presentPolicyNames[pApp->config.presentPolicy]);
+    }
+    pWindow->presentMode = presentMode;
+    if(pWindow->index == 0)
+        statsSetLabel(&pApp->stats, "present_mode", presentModeName(presentMode));
+
+    freeSwapChainSupportDetails(&swapChainSupport);
+}
+
+// All device memory goes through the sub-allocator, see allocator.h
+void createAllocator(App *pApp){
+    gpuAllocatorInit(&pApp->allocator, pApp->physicalDevice, pApp->device);
+
+    pApp->frameArenas = (GpuLinearArena *) calloc(pApp->config.framesInFlight, sizeof(GpuLinearArena));
+    for(u32 i = 0; i < pApp->config.framesInFlight; i++){
+        if(gpuLinearArenaCreate(&pApp->allocator, FRAME_ARENA_SIZE,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &pApp->frameArenas[i]) != VK_SUCCESS){
+                printf("failed to allocate frame arena!\n");
+                exit(19);
+            }
+    }
+}
+
+// Headless render targets, one per frame in flight so that drawFrame's wait on
+// the frame timeline for a frame slot also guards the image it renders into.
+void createOffscreenImages(App *pApp, AppWindow *pWindow){
+    u32 imageCount = pApp->config.framesInFlight;
+    acquireSwapChainArrays(pApp, pWindow, imageCount);
+
+    VkExtent2D extent = {WIN_WIDTH, WIN_HEIGHT};
+
+    for(u32 i = 0; i < imageCount; i++){
+        VkImageCreateInfo imageInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = OFFSCREEN_FORMAT,
+            .extent.width = extent.width,
+            .extent.height = extent.height,
+            .extent.depth = 1,
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+
+        if(vkCreateImage(pApp->device, &imageInfo, NULL, &pWindow->swapChainImages[i]) != VK_SUCCESS){
+            printf("failed to create offscreen image!\n");
+            exit(6);
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(pApp->device, pWindow->swapChainImages[i], &memRequirements);
+
+        GpuAllocation *allocation = &pWindow->offscreenImageAllocations[i];
+        if(gpuAllocate(&pApp->allocator, &memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            allocation) != VK_SUCCESS){
+            printf("failed to allocate offscreen image memory!\n");
+            exit(6);
+        }
+
+        vkBindImageMemory(pApp->device, pWindow->swapChainImages[i], allocation->memory, allocation->offset);
+    }
+
+    pApp->swapChainImageFormat = OFFSCREEN_FORMAT;
+    pWindow->swapChainExtent = extent;
+    pWindow->swapChainImageCount = imageCount;
+
+    statsSetLabel(&pApp->stats, "present_mode", "offscreen");
 }
 
 
 void createImageViews(App *pApp){
-    pApp->swapChainImageViews = (VkImageView *) malloc(
-        sizeof(VkImageView) * pApp->swapChainImageCount);
+    for(u32 i = 0; i < pApp->windowCount; i++)
+        createWindowImageViews(pApp, &pApp->windows[i]);
+}
 
-    for(u32 i = 0; i < pApp->swapChainImageCount; i++){
+// Fills the array set up by acquireSwapChainArrays
+void createWindowImageViews(App *pApp, AppWindow *pWindow){
+    for(u32 i = 0; i < pWindow->swapChainImageCount; i++){
         VkImageViewCreateInfo createInfo = {
             .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .image = pApp->swapChainImages[i],
+            .image = pWindow->swapChainImages[i],
             .viewType = VK_IMAGE_VIEW_TYPE_2D,
             .format = pApp->swapChainImageFormat,
             .components.r = VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -646,7 +1775,7 @@ void createImageViews(App *pApp){
         };
 
         if(vkCreateImageView(pApp->device, &createInfo, NULL, 
-            &pApp->swapChainImageViews[i]) != VK_SUCCESS){
+            &pWindow->swapChainImageViews[i]) != VK_SUCCESS){
                 printf("failed to crate image views!\n");
                 exit(7);
             }
@@ -655,17 +1784,294 @@ void createImageViews(App *pApp){
 
 
 // Graphic Pipelines
+static bool variantKeysEqual(const PipelineVariantKey *a, const PipelineVariantKey *b){
+    return a->topology == b->topology && a->cullMode == b->cullMode &&
+        a->blendMode == b->blendMode && a->brightness == b->brightness;
+}
+
+// Dynamic topology must stay within the class the pipeline was built with
+// unless the device reports dynamicPrimitiveTopologyUnrestricted
+static u32 topologyClass(VkPrimitiveTopology topology){
+    switch(topology){
+    case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+        return 0;
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+        return 1;
+    case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+// Registry key of the pipeline that draws pKey: dynamic axes take their default
+static PipelineVariantKey bakedVariantKey(App *pApp, const PipelineVariantKey *pKey){
+    PipelineVariantKey key = *pKey;
+
+    if(pApp->dynamicState.cullTopology){
+        key.cullMode = variantCullModes[0];
+        u32 topologyCount = sizeof(variantTopologies) / sizeof(variantTopologies[0]);
+        for(u32 t = 0; t < topologyCount; t++){
+            if(pApp->dynamicState.topologyUnrestricted ||
+                topologyClass(variantTopologies[t]) == topologyClass(pKey->topology)){
+                key.topology = variantTopologies[t];
+                break;
+            }
+        }
+    }
+    if(pApp->dynamicState.blend)
+        key.blendMode = BLEND_MODE_OPAQUE;
+
+    return key;
+}
+
+static VkColorBlendEquationEXT blendEquation(BlendMode blendMode){
+    return (VkColorBlendEquationEXT) {
+        .srcColorBlendFactor = blendMode == BLEND_MODE_ALPHA ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE,
+        .dstColorBlendFactor = blendMode == BLEND_MODE_ALPHA ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA :
+            (blendMode == BLEND_MODE_ADDITIVE ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ZERO),
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
+    };
+}
+
+// Builds the variant registry and compiles it on compile threads. Returns once
+// the variants marked required (those the first frame draws with) are ready,
+// the others keep compiling in the background.
 void createGraphicsPipeline(App *pApp) {
-    shaderFile vertShaderFile = readFile("./shaders/vert.spv");
-    shaderFile fragShaderFile = readFile("./shaders/frag.spv");
+    // Kept until the last variant has compiled, see finishPipelineVariants
+    pApp->vertShaderModule = createShaderModule(pApp->vertShaderFile, pApp);
+    pApp->fragShaderModule = createShaderModule(pApp->fragShaderFile, pApp);
+
+    unloadShader(&pApp->fragShaderFile);
+    unloadShader(&pApp->vertShaderFile);
+
+    VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(DrawPushConstants),
+    };
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &pApp->descriptorHeap.layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
+    };
+
+    if (vkCreatePipelineLayout(pApp->device, &pipelineLayoutInfo, NULL, &pApp->pipelineLayout) != VK_SUCCESS) {
+        printf("failed to create pipeline layout!\n");
+        exit(8);
+    }
+
+    // Every combination of the variant axes, the default variant first. Axes
+    // set while recording collapse onto their default, so fewer are compiled.
+    PipelineCompiler *compiler = &pApp->pipelineCompiler;
+    u32 topologyCount = sizeof(variantTopologies) / sizeof(variantTopologies[0]);
+    u32 cullModeCount = sizeof(variantCullModes) / sizeof(variantCullModes[0]);
+    u32 brightnessCount = sizeof(variantBrightness) / sizeof(variantBrightness[0]);
+
+    u32 combinationCount = topologyCount * cullModeCount * BLEND_MODE_COUNT * brightnessCount;
+    compiler->variants = (PipelineVariant *) calloc(combinationCount, sizeof(PipelineVariant));
+    compiler->variantCount = 0;
+
+    for(u32 t = 0; t < topologyCount; t++)
+    for(u32 c = 0; c < cullModeCount; c++)
+    for(u32 b = 0; b < BLEND_MODE_COUNT; b++)
+    for(u32 s = 0; s < brightnessCount; s++){
+        PipelineVariantKey key = {
+            .topology = variantTopologies[t],
+            .cullMode = variantCullModes[c],
+            .blendMode = (BlendMode) b,
+            .brightness = variantBrightness[s],
+        };
+        key = bakedVariantKey(pApp, &key);
+
+        bool registered = false;
+        for(u32 v = 0; v < compiler->variantCount && !registered; v++)
+            registered = variantKeysEqual(&compiler->variants[v].key, &key);
+        if(!registered)
+            compiler->variants[compiler->variantCount++].key = key;
+    }
+    // The default variant, and the one every draw uses so that the first frame
+    // never waits or draws with another pipeline
+    AppConfig *config = &pApp->config;
+    pApp->drawVariant = (PipelineVariantKey) {
+        .topology = variantTopologies[config->variantTopology],
+        .cullMode = variantCullModes[config->variantCullMode],
+        .blendMode = (BlendMode) config->variantBlendMode,
+        .brightness = variantBrightness[config->variantBrightness],
+    };
+    PipelineVariantKey drawKey = bakedVariantKey(pApp, &pApp->drawVariant);
+    compiler->requiredRemaining = 0;
+    for(u32 v = 0; v < compiler->variantCount; v++){
+        PipelineVariant *variant = &compiler->variants[v];
+        variant->required = v == 0 || variantKeysEqual(&variant->key, &drawKey);
+        if(variant->required)
+            compiler->requiredRemaining++;
+    }
+
+    u32 threadCount = pApp->config.compileThreads;
+    if(threadCount > compiler->variantCount)
+        threadCount = compiler->variantCount;
+
+    pthread_mutex_init(&compiler->mutex, NULL);
+    pthread_cond_init(&compiler->requiredReady, NULL);
+    compiler->threadCount = threadCount;
+    compiler->threads = (pthread_t *) malloc(sizeof(pthread_t) * threadCount);
+    compiler->start = getTimeMs();
+
+    for(u32 i = 0; i < threadCount; i++){
+        if(pthread_create(&compiler->threads[i], NULL, pipelineCompileThread, pApp) != 0){
+            printf("failed to start pipeline compile thread!\n");
+            exit(8);
+        }
+    }
+
+    pthread_mutex_lock(&compiler->mutex);
+    while(compiler->requiredRemaining > 0)
+        pthread_cond_wait(&compiler->requiredReady, &compiler->mutex);
+    pthread_mutex_unlock(&compiler->mutex);
+
+    pApp->graphicsPipeline = compiler->variants[0].pipeline;
+    printf("drawing with %s, cull %s, blend %s, brightness %s\n",
+        variantTopologyNames[config->variantTopology], variantCullModeNames[config->variantCullMode],
+        variantBlendModeNames[config->variantBlendMode], variantBrightnessNames[config->variantBrightness]);
+    printf("first frame pipelines ready in %.3f ms (%s pipeline cache), compiling %u of %u variants on %u threads\n",
+        getTimeMs() - compiler->start, pApp->pipelineCacheWarm ? "warm" : "cold",
+        compiler->variantCount, combinationCount, threadCount);
+}
+
+// VkPipelineCache is internally synchronized, so all threads share pApp->pipelineCache
+static void *pipelineCompileThread(void *pArg){
+    App *pApp = (App *) pArg;
+    PipelineCompiler *compiler = &pApp->pipelineCompiler;
+
+    for(;;){
+        pthread_mutex_lock(&compiler->mutex);
+        u32 index = compiler->nextVariant++;
+        pthread_mutex_unlock(&compiler->mutex);
+
+        if(index >= compiler->variantCount)
+            break;
+
+        PipelineVariant *variant = &compiler->variants[index];
+        VkPipeline pipeline = compilePipelineVariant(pApp, &variant->key);
+
+        pthread_mutex_lock(&compiler->mutex);
+        variant->pipeline = pipeline;
+        variant->ready = true;
+        if(variant->required){
+            compiler->requiredRemaining--;
+            pthread_cond_broadcast(&compiler->requiredReady);
+        }
+        if(++compiler->compiledCount == compiler->variantCount){
+            printf("%u pipeline variants compiled in %.3f ms\n", compiler->variantCount,
+                getTimeMs() - compiler->start);
+        }
+        pthread_mutex_unlock(&compiler->mutex);
+    }
+
+    return NULL;
+}
+
+// VK_NULL_HANDLE while the variant is still compiling or isn't registered
+VkPipeline findPipelineVariant(App *pApp, const PipelineVariantKey *pKey){
+    PipelineCompiler *compiler = &pApp->pipelineCompiler;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    PipelineVariantKey key = bakedVariantKey(pApp, pKey);
 
-    VkShaderModule vertShaderModule = createShaderModule(vertShaderFile, pApp);
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderFile, pApp);
+    pthread_mutex_lock(&compiler->mutex);
+    for(u32 i = 0; i < compiler->variantCount; i++){
+        if(variantKeysEqual(&compiler->variants[i].key, &key)){
+            if(compiler->variants[i].ready)
+                pipeline = compiler->variants[i].pipeline;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&compiler->mutex);
+
+    return pipeline;
+}
+
+// Binds the pipeline that draws pKey and sets the axes it leaves dynamic.
+// Returns false while the variant is still compiling, the draws are skipped
+// then. The drawn variant is required at startup, so that doesn't happen.
+bool recordVariantState(App *pApp, VkCommandBuffer commandBuffer, const PipelineVariantKey *pKey){
+    VkPipeline pipeline = findPipelineVariant(pApp, pKey);
+    if(pipeline == VK_NULL_HANDLE)
+        return false;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    const ExtendedDynamicState *state = &pApp->dynamicState;
+    if(state->cullTopology){
+        state->setCullMode(commandBuffer, pKey->cullMode);
+        state->setFrontFace(commandBuffer, VK_FRONT_FACE_CLOCKWISE);
+        state->setPrimitiveTopology(commandBuffer, pKey->topology);
+    }
+    if(state->blend){
+        VkBool32 blendEnable = pKey->blendMode != BLEND_MODE_OPAQUE;
+        VkColorBlendEquationEXT equation = blendEquation(pKey->blendMode);
+        state->setColorBlendEnable(commandBuffer, 0, 1, &blendEnable);
+        state->setColorBlendEquation(commandBuffer, 0, 1, &equation);
+    }
+    return true;
+}
+
+// Waits for the background compiles, then releases the shader modules
+void finishPipelineVariants(App *pApp){
+    PipelineCompiler *compiler = &pApp->pipelineCompiler;
+    if(compiler->threads == NULL)
+        return;
+
+    for(u32 i = 0; i < compiler->threadCount; i++){
+        pthread_join(compiler->threads[i], NULL);
+    }
+    free(compiler->threads);
+    compiler->threads = NULL;
+
+    vkDestroyShaderModule(pApp->device, pApp->fragShaderModule, NULL);
+    vkDestroyShaderModule(pApp->device, pApp->vertShaderModule, NULL);
+}
+
+void destroyPipelineVariants(App *pApp){
+    PipelineCompiler *compiler = &pApp->pipelineCompiler;
+
+    finishPipelineVariants(pApp);
+    for(u32 i = 0; i < compiler->variantCount; i++){
+        vkDestroyPipeline(pApp->device, compiler->variants[i].pipeline, NULL);
+    }
+    free(compiler->variants);
+
+    pthread_mutex_destroy(&compiler->mutex);
+    pthread_cond_destroy(&compiler->requiredReady);
+}
+
+VkPipeline compilePipelineVariant(App *pApp, const PipelineVariantKey *pKey) {
+    VkSpecializationMapEntry brightnessEntry = {
+        .constantID = 0,
+        .offset = 0,
+        .size = sizeof(float),
+    };
+
+    VkSpecializationInfo specializationInfo = {
+        .mapEntryCount = 1,
+        .pMapEntries = &brightnessEntry,
+        .dataSize = sizeof(float),
+        .pData = &pKey->brightness,
+    };
 
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_VERTEX_BIT,
-        .module = vertShaderModule,
+        .module = pApp->vertShaderModule,
         .pName = "main",
         .pSpecializationInfo = NULL
     };
@@ -673,47 +2079,79 @@ void createGraphicsPipeline(App *pApp) {
     VkPipelineShaderStageCreateInfo fragShaderStageInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-        .module = fragShaderModule,
+        .module = pApp->fragShaderModule,
         .pName = "main",
-        .pSpecializationInfo = NULL
+        .pSpecializationInfo = &specializationInfo,
     };
 
     VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
+    VkVertexInputBindingDescription bindingDescription = {
+        .binding = 0,
+        .stride = sizeof(Vertex),
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+    };
+
+    VkVertexInputAttributeDescription attributeDescriptions[] = {
+        {
+            .binding = 0,
+            .location = 0,
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(Vertex, pos),
+        },
+        {
+            .binding = 0,
+            .location = 1,
+            .format = VK_FORMAT_R32G32B32_SFLOAT,
+            .offset = offsetof(Vertex, color),
+        },
+    };
+
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 0,
-        .pVertexBindingDescriptions = NULL, // Optional
-        .vertexAttributeDescriptionCount = 0,
-        .pVertexAttributeDescriptions = NULL, // Optional
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &bindingDescription,
+        .vertexAttributeDescriptionCount = 2,
+        .pVertexAttributeDescriptions = attributeDescriptions,
     };
     
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .topology = pKey->topology,
         .primitiveRestartEnable = VK_FALSE,
     };
 
     VkViewport viewport = {
         viewport.x = 0.0f,
         viewport.y = 0.0f,
-        viewport.width = (float) pApp->swapChainExtent.width,
-        viewport.height = (float) pApp->swapChainExtent.height,
+        viewport.width = (float) pApp->windows[0].swapChainExtent.width,
+        viewport.height = (float) pApp->windows[0].swapChainExtent.height,
         viewport.minDepth = 0.0f,
         viewport.maxDepth = 1.0f,
     };
 
     VkRect2D scissor = {
         .offset = {0, 0},
-        .extent = pApp->swapChainExtent,
+        .extent = pApp->windows[0].swapChainExtent,
     };
 
-    VkDynamicState dynamicStates[] = {
+    VkDynamicState dynamicStates[7] = {
         VK_DYNAMIC_STATE_VIEWPORT,
         VK_DYNAMIC_STATE_SCISSOR
     };
     u32 dynamicStatesCount = 2;
 
+    // The baked values below are ignored for these, see recordVariantState
+    if(pApp->dynamicState.cullTopology){
+        dynamicStates[dynamicStatesCount++] = VK_DYNAMIC_STATE_CULL_MODE_EXT;
+        dynamicStates[dynamicStatesCount++] = VK_DYNAMIC_STATE_FRONT_FACE_EXT;
+        dynamicStates[dynamicStatesCount++] = VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT;
+    }
+    if(pApp->dynamicState.blend){
+        dynamicStates[dynamicStatesCount++] = VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT;
+        dynamicStates[dynamicStatesCount++] = VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT;
+    }
+
     VkPipelineDynamicStateCreateInfo dynamicState = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
         .dynamicStateCount = (u32) dynamicStatesCount,
@@ -734,7 +2172,7 @@ void createGraphicsPipeline(App *pApp) {
         .rasterizerDiscardEnable = VK_FALSE,
         .polygonMode = VK_POLYGON_MODE_FILL,
         .lineWidth = 1.0f,
-        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .cullMode = pKey->cullMode,
         .frontFace = VK_FRONT_FACE_CLOCKWISE,
         .depthBiasEnable = VK_FALSE,
         .depthBiasConstantFactor = 0.0f, // Optional
@@ -752,15 +2190,16 @@ void createGraphicsPipeline(App *pApp) {
         .alphaToOneEnable = VK_FALSE, // Optional        
     };
 
+    VkColorBlendEquationEXT equation = blendEquation(pKey->blendMode);
     VkPipelineColorBlendAttachmentState colorBlendAttachment = {
         .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-        .blendEnable = VK_FALSE,
-        .srcColorBlendFactor = VK_BLEND_FACTOR_ONE, // Optional
-        .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO, // Optional
-        .colorBlendOp = VK_BLEND_OP_ADD, // Optional
-        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE, // Optional
-        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO, // Optional
-        .alphaBlendOp = VK_BLEND_OP_ADD, // Optional
+        .blendEnable = pKey->blendMode != BLEND_MODE_OPAQUE,
+        .srcColorBlendFactor = equation.srcColorBlendFactor,
+        .dstColorBlendFactor = equation.dstColorBlendFactor,
+        .colorBlendOp = equation.colorBlendOp,
+        .srcAlphaBlendFactor = equation.srcAlphaBlendFactor,
+        .dstAlphaBlendFactor = equation.dstAlphaBlendFactor,
+        .alphaBlendOp = equation.alphaBlendOp,
     };
 
     VkPipelineColorBlendStateCreateInfo colorBlending= {
@@ -775,21 +2214,16 @@ void createGraphicsPipeline(App *pApp) {
         .blendConstants[3] = 0.0f, // Optional
     };
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 0, // Optional
-        .pSetLayouts = NULL, // Optional
-        .pushConstantRangeCount = 0, // Optional
-        .pPushConstantRanges = NULL, // Optional
+    // Dynamic rendering names the attachment formats here instead of a render pass
+    VkPipelineRenderingCreateInfoKHR renderingInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &pApp->swapChainImageFormat,
     };
 
-    if (vkCreatePipelineLayout(pApp->device, &pipelineLayoutInfo, NULL, &pApp->pipelineLayout) != VK_SUCCESS) {
-        printf("failed to create pipeline layout!\n");
-        exit(8);
-    }
-
     VkGraphicsPipelineCreateInfo pipelineInfo = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = pApp->config.dynamicRendering ? &renderingInfo : NULL,
         .stageCount = 2,
         .pStages = shaderStages,
         .pVertexInputState = &vertexInputInfo,
@@ -806,51 +2240,223 @@ void createGraphicsPipeline(App *pApp) {
         .basePipelineHandle = VK_NULL_HANDLE, // Optional
         .basePipelineIndex = -1, // Optional
     };
-    if (vkCreateGraphicsPipelines(pApp->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pApp->graphicsPipeline) != VK_SUCCESS) {
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(pApp->device, pApp->pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
         printf("failed to create graphics pipeline!\n");
         exit(8);
     }
+    return pipeline;
+}
+
+// Pipeline Cache
+// File I/O only, validated against the device in createPipelineCache
+void loadPipelineCacheFile(App *pApp){
+    const char *path = pApp->config.pipelineCachePath;
+    void *data = NULL;
+    size_t size = 0;
+
+    FILE *file = fopen(path, "rb");
+    if(file != NULL){
+        fseek(file, 0L, SEEK_END);
+        long fileSize = ftell(file);
+        fseek(file, 0L, SEEK_SET);
+
+        if(fileSize > 0){
+            size = (size_t) fileSize;
+            data = malloc(size);
+            if(data == NULL || fread(data, 1, size, file) != size){
+                printf("failed to read pipeline cache %s, starting cold\n", path);
+                free(data);
+                data = NULL;
+                size = 0;
+            }
+        }
+        fclose(file);
+    }
+
+    pApp->pipelineCacheData = data;
+    pApp->pipelineCacheDataSize = size;
+}
+
+void createPipelineCache(App *pApp){
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(pApp->physicalDevice, &properties);
+
+    const char *path = pApp->config.pipelineCachePath;
+    void *data = pApp->pipelineCacheData;
+    size_t size = pApp->pipelineCacheDataSize;
+
+    if(data != NULL && !isPipelineCacheCompatible(data, size, &properties)){
+        printf("discarding stale pipeline cache %s\n", path);
+        free(data);
+        data = NULL;
+        size = 0;
+    }
+
+    VkPipelineCacheCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = size,
+        .pInitialData = data,
+    };
+
+    if(vkCreatePipelineCache(pApp->device, &createInfo, NULL, &pApp->pipelineCache) != VK_SUCCESS){
+        printf("failed to create pipeline cache!\n");
+        exit(8);
+    }
+
+    pApp->pipelineCacheWarm = data != NULL;
+    free(data);
+    pApp->pipelineCacheData = NULL;
+    pApp->pipelineCacheDataSize = 0;
+}
+
+// The blob starts with a VkPipelineCacheHeaderVersionOne; the driver would
+// silently ignore a mismatching blob, but checking it ourselves lets us report it.
+bool isPipelineCacheCompatible(const void *data, size_t size, const VkPhysicalDeviceProperties *pProperties){
+    const size_t headerSize = 4 * sizeof(u32) + VK_UUID_SIZE;
+    if(size < headerSize)
+        return false;
+
+    u32 header[4];
+    memcpy(header, data, sizeof(header));
+    const u8 *uuid = (const u8 *) data + sizeof(header);
+
+    return header[0] >= headerSize &&
+        header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header[2] == pProperties->vendorID &&
+        header[3] == pProperties->deviceID &&
+        memcmp(uuid, pProperties->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void savePipelineCache(App *pApp){
+    size_t size = 0;
+    if(vkGetPipelineCacheData(pApp->device, pApp->pipelineCache, &size, NULL) != VK_SUCCESS || size == 0)
+        return;
+
+    void *data = malloc(size);
+    if(data == NULL || vkGetPipelineCacheData(pApp->device, pApp->pipelineCache, &size, data) != VK_SUCCESS){
+        printf("failed to retrieve pipeline cache data\n");
+        free(data);
+        return;
+    }
+
+    // Write to a private file and rename it so concurrent processes never
+    // observe a partially written cache.
+    const char *path = pApp->config.pipelineCachePath;
+    char tmpPath[4096];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", path, (long) getpid());
+
+    FILE *file = fopen(tmpPath, "wb");
+    if(file == NULL){
+        printf("failed to open %s for writing\n", tmpPath);
+        free(data);
+        return;
+    }
+
+    bool written = fwrite(data, 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+
+    if(!written || rename(tmpPath, path) != 0){
+        printf("failed to write pipeline cache %s\n", path);
+        remove(tmpPath);
+    }
+
+    free(data);
+}
+
+// Shaders live in --shader-dir, or in shaders/ next to the executable so the
+// working directory doesn't matter.
+static void shaderPath(App *pApp, const char *name, char *path, size_t pathSize){
+    if(pApp->config.shaderDir != NULL){
+        snprintf(path, pathSize, "%s/%s", pApp->config.shaderDir, name);
+        return;
+    }
 
-    free(fragShaderFile.code);
-    free(vertShaderFile.code);
+    char exePath[SHADER_PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+    char *slash = NULL;
+    if(length > 0){
+        exePath[length] = '\0';
+        slash = strrchr(exePath, '/');
+    }
 
-    vkDestroyShaderModule(pApp->device, fragShaderModule, NULL);
-    vkDestroyShaderModule(pApp->device, vertShaderModule, NULL);
+    if(slash == NULL){
+        snprintf(path, pathSize, "shaders/%s", name);
+    }else{
+        *slash = '\0';
+        snprintf(path, pathSize, "%s/shaders/%s", exePath, name);
+    }
 }
 
-static shaderFile readFile(char *filename){
+// Maps the SPIR-V read-only, createShaderModule reads it straight from the page cache
+shaderFile loadShader(App *pApp, const char *name){
+    char path[SHADER_PATH_MAX];
+    shaderPath(pApp, name, path, sizeof(path));
 
-    FILE *file;
-    if((file = fopen(filename,"rb")) == NULL){
-        printf("failed to open %s\n", filename);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        printf("failed to open %s\n", path);
         exit(8);
     }
 
-    fseek(file,0L,SEEK_END);
-    size_t size = ftell(file);
-    fseek(file, 0L, SEEK_SET);
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < 4 || st.st_size % 4 != 0){
+        printf("%s is not a SPIR-V binary\n", path);
+        exit(8);
+    }
 
-    char *buffer = (char *)malloc(size);
-    if(buffer == NULL){
-        printf("can't allocate buffer to read the shader binary file!\n");
+    void *code = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(code == MAP_FAILED){
+        printf("failed to map %s\n", path);
         exit(8);
     }
-    fread(buffer, size, sizeof(char), file);
 
-    fclose(file);
+    if(((const u32 *) code)[0] != SPIRV_MAGIC){
+        printf("%s is not a SPIR-V binary\n", path);
+        exit(8);
+    }
 
     shaderFile shaderFile = {
-        .code = buffer,
-        .size = size
+        .code = (const u32 *) code,
+        .size = (size_t) st.st_size,
+        .mapped = true,
     };
     return shaderFile;
 }
 
+// Runs before the device exists; the readahead hint lets the page cache fill
+// while instance and device creation are still going on
+void loadShaders(App *pApp){
+#ifdef EMBED_SHADERS
+    pApp->vertShaderFile = (shaderFile) {.code = embeddedVertShader, .size = sizeof(embeddedVertShader)};
+    pApp->fragShaderFile = (shaderFile) {.code = embeddedFragShader, .size = sizeof(embeddedFragShader)};
+    if(pApp->config.animate)
+        pApp->compShaderFile = (shaderFile) {.code = embeddedCompShader, .size = sizeof(embeddedCompShader)};
+#else
+    pApp->vertShaderFile = loadShader(pApp, "vert.spv");
+    pApp->fragShaderFile = loadShader(pApp, "frag.spv");
+    posix_madvise((void *) pApp->vertShaderFile.code, pApp->vertShaderFile.size, POSIX_MADV_WILLNEED);
+    posix_madvise((void *) pApp->fragShaderFile.code, pApp->fragShaderFile.size, POSIX_MADV_WILLNEED);
+    if(pApp->config.animate){
+        pApp->compShaderFile = loadShader(pApp, "comp.spv");
+        posix_madvise((void *) pApp->compShaderFile.code, pApp->compShaderFile.size, POSIX_MADV_WILLNEED);
+    }
+#endif
+}
+
+void unloadShader(shaderFile *pShaderFile){
+    if(pShaderFile->mapped){
+        munmap((void *) pShaderFile->code, pShaderFile->size);
+    }
+    pShaderFile->code = NULL;
+}
+
 VkShaderModule createShaderModule(shaderFile shaderFile, App *pApp) {
     VkShaderModuleCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
         .codeSize = shaderFile.size,
-        .pCode = (u32 *) shaderFile.code,
+        .pCode = shaderFile.code,
     };
 
     VkShaderModule shaderModule;
@@ -865,6 +2471,9 @@ VkShaderModule createShaderModule(shaderFile shaderFile, App *pApp) {
 
 // Rander Pass
 void createRenderPass(App *pApp){
+    if(pApp->config.dynamicRendering)
+        return;
+
     VkAttachmentDescription colorAttachment = {
         .format = pApp->swapChainImageFormat,
         .samples = VK_SAMPLE_COUNT_1_BIT,
@@ -873,7 +2482,9 @@ void createRenderPass(App *pApp){
         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        // Offscreen targets are left ready to be copied out instead of presented
+        .finalLayout = pApp->config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                             : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
     };
 
     VkAttachmentReference colorAttachmentRef = {
@@ -915,15 +2526,19 @@ void createRenderPass(App *pApp){
 
 // Framebuffers
 void createFramebuffers(App *pApp){
-    
-    pApp->swapChainFramebuffers = (VkFramebuffer *) malloc(
-        sizeof(VkFramebuffer) * pApp->swapChainImageCount
-    );
+    for(u32 i = 0; i < pApp->windowCount; i++)
+        createWindowFramebuffers(pApp, &pApp->windows[i]);
+}
+
+// Fills the array set up by acquireSwapChainArrays
+void createWindowFramebuffers(App *pApp, AppWindow *pWindow){
+    if(pApp->config.dynamicRendering)
+        return;
 
-    for(u32 i = 0; i < pApp->swapChainImageCount; i++){
+    for(u32 i = 0; i < pWindow->swapChainImageCount; i++){
         
         VkImageView attachments[] = {
-            pApp->swapChainImageViews[i]
+            pWindow->swapChainImageViews[i]
         };
 
         VkFramebufferCreateInfo framebufferInfo = {
@@ -931,12 +2546,12 @@ void createFramebuffers(App *pApp){
             .renderPass = pApp->renderPass,
             .attachmentCount = 1,
             .pAttachments = attachments,
-            .width = pApp->swapChainExtent.width,
-            .height = pApp->swapChainExtent.height,
+            .width = pWindow->swapChainExtent.width,
+            .height = pWindow->swapChainExtent.height,
             .layers = 1,
         };
 
-        if (vkCreateFramebuffer(pApp->device, &framebufferInfo, NULL, &pApp->swapChainFramebuffers[i]) != VK_SUCCESS) {
+        if (vkCreateFramebuffer(pApp->device, &framebufferInfo, NULL, &pWindow->swapChainFramebuffers[i]) != VK_SUCCESS) {
             printf("failed to create framebuffer!\n");
             exit(10);
         }
@@ -944,7 +2559,7 @@ void createFramebuffers(App *pApp){
 }
 
 void createCommandPool(App *pApp){
-    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(pApp->physicalDevice, pApp->surface);
+    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(pApp->physicalDevice, pApp->windows[0].surface);
 
     VkCommandPoolCreateInfo poolInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -956,10 +2571,24 @@ void createCommandPool(App *pApp){
         printf("failed to create command pool!\n");
         exit(11);
     }
+
+    if(pApp->transferQueue == VK_NULL_HANDLE)
+        return;
+
+    VkCommandPoolCreateInfo transferPoolInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queueFamilyIndices.transferFamily,
+    };
+
+    if (vkCreateCommandPool(pApp->device, &transferPoolInfo, NULL, &pApp->transferCommandPool) != VK_SUCCESS) {
+        printf("failed to create transfer command pool!\n");
+        exit(11);
+    }
 }
 
 void createCommandbuffers(App *pApp){
-    pApp->commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+    pApp->commandBufferCount = pApp->config.framesInFlight;
 
     VkCommandBufferAllocateInfo allocInfo= {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -978,196 +2607,1792 @@ void createCommandbuffers(App *pApp){
     }
 }
 
-void recordCommandBuffer(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex) {
-    VkCommandBufferBeginInfo beginInfo = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = 0, // Optional
-        .pInheritanceInfo = NULL, // Optional
+// Concurrent sharing between several queue families, no ownership transfers
+void createSharedBuffer(App *pApp, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+    const u32 *queueFamilies, u32 queueFamilyCount, VkBuffer *pBuffer, GpuAllocation *pAllocation){
+    VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_CONCURRENT,
+        .queueFamilyIndexCount = queueFamilyCount,
+        .pQueueFamilyIndices = queueFamilies,
     };
 
-    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-        printf("failed to begin recording command buffer!\n");
-        exit(13);
+    if (vkCreateBuffer(pApp->device, &bufferInfo, NULL, pBuffer) != VK_SUCCESS) {
+        printf("failed to create buffer!\n");
+        exit(19);
     }
 
-    VkRenderPassBeginInfo renderPassInfo = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = pApp->renderPass,
-        .framebuffer = pApp->swapChainFramebuffers[imageIndex],
-        .renderArea.offset = {0, 0},
-        .renderArea.extent = pApp->swapChainExtent,
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(pApp->device, *pBuffer, &memRequirements);
+
+    if (gpuAllocate(&pApp->allocator, &memRequirements, properties, pAllocation) != VK_SUCCESS) {
+        printf("failed to allocate buffer memory!\n");
+        exit(19);
+    }
+
+    vkBindBufferMemory(pApp->device, *pBuffer, pAllocation->memory, pAllocation->offset);
+}
+
+// pArena: transient buffers are placed in the arena when they fit, NULL for long-lived ones
+void createBuffer(App *pApp, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+    GpuLinearArena *pArena, VkBuffer *pBuffer, GpuAllocation *pAllocation){
+    VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
 
-    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+    if (vkCreateBuffer(pApp->device, &bufferInfo, NULL, pBuffer) != VK_SUCCESS) {
+        printf("failed to create buffer!\n");
+        exit(19);
+    }
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(pApp->device, *pBuffer, &memRequirements);
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pApp->graphicsPipeline);
+    bool placed = pArena != NULL && gpuLinearAllocate(pArena, &memRequirements, pAllocation);
+    if (!placed && gpuAllocate(&pApp->allocator, &memRequirements, properties, pAllocation) != VK_SUCCESS) {
+        printf("failed to allocate buffer memory!\n");
+        exit(19);
+    }
 
-    VkViewport viewport = {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = (float) pApp->swapChainExtent.width,
-        .height = (float) pApp->swapChainExtent.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
+    vkBindBufferMemory(pApp->device, *pBuffer, pAllocation->memory, pAllocation->offset);
+}
 
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+void createGeometryBuffers(App *pApp){
+    VkDeviceSize vertexSize = sizeof(vertices);
+    VkDeviceSize indexSize = sizeof(indices);
 
-    VkRect2D scissor = {
-        .offset.x = 0,
-        .offset.y = 0,
-        .extent = pApp->swapChainExtent,
+    createBuffer(pApp, vertexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, NULL, &pApp->vertexBuffer, &pApp->vertexAllocation);
+    createBuffer(pApp, indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, NULL, &pApp->indexBuffer, &pApp->indexAllocation);
+    pApp->indexCount = sizeof(indices) / sizeof(indices[0]);
+
+    BufferUpload uploads[] = {
+        {.dst = pApp->vertexBuffer, .data = vertices, .size = vertexSize},
+        {.dst = pApp->indexBuffer, .data = indices, .size = indexSize},
     };
+    uploadBuffers(pApp, uploads, 2);
+}
 
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+// One heap for the lifetime of the device. The arrays are sized up front, the
+// update-after-bind limits are far above what the non-bindless limits allow.
+void createDescriptorHeap(App *pApp){
+    VkPhysicalDeviceVulkan12Properties vulkan12Properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+    };
+    VkPhysicalDeviceProperties2 deviceProperties2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &vulkan12Properties,
+    };
+    vkGetPhysicalDeviceProperties2(pApp->physicalDevice, &deviceProperties2);
+
+    // Combined image samplers count as both a sampled image and a sampler
+    u32 bufferCapacity = BINDLESS_MAX_BUFFERS;
+    if(bufferCapacity > vulkan12Properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers)
+        bufferCapacity = vulkan12Properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers;
+    if(bufferCapacity > vulkan12Properties.maxDescriptorSetUpdateAfterBindStorageBuffers)
+        bufferCapacity = vulkan12Properties.maxDescriptorSetUpdateAfterBindStorageBuffers;
+
+    u32 resourceLimit = vulkan12Properties.maxPerStageUpdateAfterBindResources;
+    u32 imageCapacity = BINDLESS_MAX_IMAGES;
+    u32 imageLimits[] = {
+        vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+        vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers,
+        vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages,
+        vulkan12Properties.maxDescriptorSetUpdateAfterBindSamplers,
+        resourceLimit > bufferCapacity ? resourceLimit - bufferCapacity : 0,
+    };
+    for(u32 i = 0; i < sizeof(imageLimits) / sizeof(imageLimits[0]); i++){
+        if(imageCapacity > imageLimits[i])
+            imageCapacity = imageLimits[i];
+    }
 
-    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    // compute: --animate writes instances through the heap too
+    VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
+        VK_SHADER_STAGE_COMPUTE_BIT;
+    if (bindlessHeapCreate(&pApp->descriptorHeap, pApp->device, bufferCapacity, imageCapacity, stages) != VK_SUCCESS) {
+        printf("failed to create descriptor heap!\n");
+        exit(21);
+    }
+    bindlessHeapWriteStats(&pApp->descriptorHeap, stdout);
+}
 
-    vkCmdEndRenderPass(commandBuffer);
+// Lays the instances out on a square grid covering the viewport
+void createInstanceBuffer(App *pApp, u32 instanceCount){
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(pApp->physicalDevice, &properties);
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-        printf("failed to record command buffer!");
-        exit(14);
+    u32 maxInstances = properties.limits.maxStorageBufferRange / sizeof(InstanceData);
+    if(instanceCount > maxInstances){
+        printf("%u instances exceed maxStorageBufferRange, drawing %u\n", instanceCount, maxInstances);
+        instanceCount = maxInstances;
     }
-}
 
+    VkDeviceSize bufferSize = sizeof(InstanceData) * (VkDeviceSize) instanceCount;
+    InstanceData *instances = (InstanceData *) malloc(bufferSize);
 
-void drawFrame(App *pApp) {
+    u32 side = 1;
+    while((uint64_t) side * side < instanceCount)
+        side++;
+    float cell = 2.0f / side;
+    float scale = side == 1 ? 1.0f : cell * 0.9f;
 
-    vkWaitForFences(pApp->device, 1, &pApp->inFlightFences[pApp->currentFrame], VK_TRUE, UINT64_MAX);
-    
-    u32 imageIndex;
-    VkResult result = vkAcquireNextImageKHR(pApp->device, pApp->swapChain, UINT64_MAX, 
-        pApp->imageAvailableSemaphores[pApp->currentFrame], VK_NULL_HANDLE, &imageIndex);
+    for(u32 i = 0; i < instanceCount; i++){
+        float u = (float) (i % side) / side;
+        float v = (float) (i / side) / side;
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        recreateSwapChain(pApp);
-        return;
-    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-        printf("failed to acquire swap chain image!");
-        exit(15);
+        instances[i] = (InstanceData) {
+            .offset = {-1.0f + cell * ((i % side) + 0.5f), -1.0f + cell * ((i / side) + 0.5f)},
+            .scale = scale,
+            .color = {1.0f - 0.5f * u, 1.0f - 0.5f * v, 0.5f + 0.5f * u, 1.0f},
+        };
+        // A single instance keeps the original triangle colors
+        if(side == 1)
+            instances[i].color[2] = 1.0f;
     }
 
-    vkResetFences(pApp->device, 1, &pApp->inFlightFences[pApp->currentFrame]);
-        
-    vkResetCommandBuffer(pApp->commandBuffers[pApp->currentFrame], 0);
-    recordCommandBuffer(pApp, pApp->commandBuffers[pApp->currentFrame], imageIndex);
+    createBuffer(pApp, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, NULL, &pApp->instanceBuffer, &pApp->instanceAllocation);
 
-    
-    VkSemaphore waitSemaphores[] = {pApp->imageAvailableSemaphores[pApp->currentFrame]};
-    VkSemaphore signalSemaphores[] = {pApp->renderFinishedSemaphores[pApp->currentFrame]};
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    
-    VkSubmitInfo submitInfo = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
+    BufferUpload upload = {.dst = pApp->instanceBuffer, .data = instances, .size = bufferSize};
+    uploadBuffers(pApp, &upload, 1);
+    free(instances);
+
+    pApp->instanceCount = instanceCount;
+    pApp->drawCount = pApp->config.drawBatch == 0 ? 1 :
+        (instanceCount + pApp->config.drawBatch - 1) / pApp->config.drawBatch;
+
+    char label[STATS_LABEL_LENGTH];
+    snprintf(label, sizeof(label), "%u", instanceCount);
+    statsSetLabel(&pApp->stats, "instances", label);
+}
+
+void destroyInstanceBuffer(App *pApp){
+    vkDestroyBuffer(pApp->device, pApp->instanceBuffer, NULL);
+    gpuFree(&pApp->allocator, &pApp->instanceAllocation);
+    pApp->instanceBuffer = VK_NULL_HANDLE;
+}
+
+void createInstanceDescriptor(App *pApp){
+    pApp->instanceSlot = bindlessAddBuffer(&pApp->descriptorHeap, pApp->instanceBuffer, 0, VK_WHOLE_SIZE);
+    if(pApp->instanceSlot == BINDLESS_INVALID_SLOT){
+        printf("failed to add instance buffer to the descriptor heap!\n");
+        exit(21);
+    }
+}
+
+// Points the instance slot at a replaced instance buffer
+void writeInstanceDescriptor(App *pApp){
+    bindlessSetBuffer(&pApp->descriptorHeap, pApp->instanceSlot, pApp->instanceBuffer, 0, VK_WHOLE_SIZE);
+}
+
+void createComputePipeline(App *pApp){
+    if(!pApp->config.animate)
+        return;
+
+    VkShaderModule compShaderModule = createShaderModule(pApp->compShaderFile, pApp);
+    unloadShader(&pApp->compShaderFile);
+
+    VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(AnimationPushConstants),
+    };
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &pApp->descriptorHeap.layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
+    };
+
+    if (vkCreatePipelineLayout(pApp->device, &pipelineLayoutInfo, NULL, &pApp->computePipelineLayout) != VK_SUCCESS) {
+        printf("failed to create compute pipeline layout!\n");
+        exit(22);
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = compShaderModule,
+            .pName = "main",
+        },
+        .layout = pApp->computePipelineLayout,
+    };
+
+    if (vkCreateComputePipelines(pApp->device, pApp->pipelineCache, 1, &pipelineInfo, NULL,
+        &pApp->computePipeline) != VK_SUCCESS) {
+        printf("failed to create compute pipeline!\n");
+        exit(22);
+    }
+
+    vkDestroyShaderModule(pApp->device, compShaderModule, NULL);
+}
+
+// One instance buffer, heap slot and compute command buffer per frame in
+// flight. The frame timeline wait in drawFrame covers their reuse: graphics
+// of an older frame finished reading the buffer, and its compute pass had to
+// finish before that.
+void createAnimation(App *pApp){
+    if(!pApp->config.animate)
+        return;
+
+    u32 frames = pApp->config.framesInFlight;
+    QueueFamilyIndices *indices = &pApp->queueFamilyIndices;
+    bool asyncCompute = pApp->computeQueue != VK_NULL_HANDLE;
+    u32 queueFamilies[] = {indices->graphicsFamily, indices->computeFamily};
+    VkDeviceSize bufferSize = sizeof(InstanceData) * (VkDeviceSize) pApp->instanceCount;
+
+    pApp->animatedInstanceBuffers = (VkBuffer *) malloc(sizeof(VkBuffer) * frames);
+    pApp->animatedInstanceAllocations = (GpuAllocation *) malloc(sizeof(GpuAllocation) * frames);
+    pApp->animatedInstanceSlots = (u32 *) malloc(sizeof(u32) * frames);
+    pApp->computeCommandBuffers = (VkCommandBuffer *) malloc(sizeof(VkCommandBuffer) * frames);
+
+    for(u32 i = 0; i < frames; i++){
+        if(asyncCompute && indices->computeFamily != indices->graphicsFamily){
+            createSharedBuffer(pApp, bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, queueFamilies, 2,
+                &pApp->animatedInstanceBuffers[i], &pApp->animatedInstanceAllocations[i]);
+        }else{
+            createBuffer(pApp, bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                NULL, &pApp->animatedInstanceBuffers[i], &pApp->animatedInstanceAllocations[i]);
+        }
+
+        pApp->animatedInstanceSlots[i] = bindlessAddBuffer(&pApp->descriptorHeap,
+            pApp->animatedInstanceBuffers[i], 0, VK_WHOLE_SIZE);
+        if(pApp->animatedInstanceSlots[i] == BINDLESS_INVALID_SLOT){
+            printf("failed to add animation buffer to the descriptor heap!\n");
+            exit(21);
+        }
+    }
+
+    VkCommandPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = asyncCompute ? indices->computeFamily : indices->graphicsFamily,
+    };
+
+    if (vkCreateCommandPool(pApp->device, &poolInfo, NULL, &pApp->computeCommandPool) != VK_SUCCESS) {
+        printf("failed to create compute command pool!\n");
+        exit(11);
+    }
+
+    VkCommandBufferAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = pApp->computeCommandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = frames,
+    };
+
+    if (vkAllocateCommandBuffers(pApp->device, &allocInfo, pApp->computeCommandBuffers) != VK_SUCCESS) {
+        printf("failed to allocate compute command buffers!\n");
+        exit(12);
+    }
+
+    VkSemaphoreTypeCreateInfo timelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    VkSemaphoreCreateInfo semaphoreInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &timelineInfo,
+    };
+
+    if (vkCreateSemaphore(pApp->device, &semaphoreInfo, NULL, &pApp->computeTimeline) != VK_SUCCESS) {
+        printf("failed to create compute timeline semaphore!\n");
+        exit(17);
+    }
+
+    pApp->animationStart = getTimeMs();
+    printf("animating %u instances on the %s queue\n", pApp->instanceCount,
+        asyncCompute ? "async compute" : "graphics");
+}
+
+// Device must be idle
+void destroyAnimation(App *pApp){
+    if(!pApp->config.animate)
+        return;
+
+    vkDestroySemaphore(pApp->device, pApp->computeTimeline, NULL);
+    vkDestroyCommandPool(pApp->device, pApp->computeCommandPool, NULL);
+    free(pApp->computeCommandBuffers);
+
+    for(u32 i = 0; i < pApp->config.framesInFlight; i++){
+        bindlessRemoveBuffer(&pApp->descriptorHeap, pApp->animatedInstanceSlots[i]);
+        vkDestroyBuffer(pApp->device, pApp->animatedInstanceBuffers[i], NULL);
+        gpuFree(&pApp->allocator, &pApp->animatedInstanceAllocations[i]);
+    }
+    free(pApp->animatedInstanceBuffers);
+    free(pApp->animatedInstanceAllocations);
+    free(pApp->animatedInstanceSlots);
+
+    vkDestroyPipeline(pApp->device, pApp->computePipeline, NULL);
+    vkDestroyPipelineLayout(pApp->device, pApp->computePipelineLayout, NULL);
+}
+
+// Writes this frame's instances and signals computeTimeline with frameValue.
+// Submitted ahead of the frame's graphics work, so on an async compute queue
+// it overlaps the graphics of the frames still in flight.
+void submitAnimation(App *pApp, uint64_t frameValue){
+    VkCommandBuffer commandBuffer = pApp->computeCommandBuffers[pApp->currentFrame];
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    u32 side = 1;
+    while((uint64_t) side * side < pApp->instanceCount)
+        side++;
+
+    AnimationPushConstants constants = {
+        .time = (float) ((getTimeMs() - pApp->animationStart) / 1000.0),
+        .instanceCount = pApp->instanceCount,
+        .side = side,
+        .instanceBuffer = pApp->animatedInstanceSlots[pApp->currentFrame],
+    };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pApp->computePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pApp->computePipelineLayout,
+        0, 1, &pApp->descriptorHeap.set, 0, NULL);
+    vkCmdPushConstants(commandBuffer, pApp->computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+        0, sizeof(constants), &constants);
+
+    // 64 invocations per group, rows of at most 65535 groups (the guaranteed limit)
+    u32 groupCount = (pApp->instanceCount + 63) / 64;
+    u32 groupCountX = groupCount < 65535 ? groupCount : 65535;
+    vkCmdDispatch(commandBuffer, groupCountX, (groupCount + groupCountX - 1) / groupCountX, 1);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        printf("failed to record compute command buffer!\n");
+        exit(22);
+    }
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &frameValue,
+    };
+
+    VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &pApp->computeTimeline,
+    };
+
+    VkQueue queue = pApp->computeQueue != VK_NULL_HANDLE ? pApp->computeQueue : pApp->graphicsQueue;
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        printf("failed to submit compute command buffer!\n");
+        exit(22);
+    }
+}
+
+// Benchmark only: drains the device, swaps the instance buffer and re-records
+void setInstanceCount(App *pApp, u32 instanceCount){
+    vkDeviceWaitIdle(pApp->device);
+
+    destroyInstanceBuffer(pApp);
+    createInstanceBuffer(pApp, instanceCount);
+
+    writeInstanceDescriptor(pApp);
+
+    // The draw's instance count is baked into the static command buffers
+    freeStaticCommandBuffers(pApp);
+    createStaticCommandBuffers(pApp);
+}
+
+// Copies every upload through one shared staging buffer with a single
+// submit and a single fence wait on the graphics queue.
+// Uploaded buffers feed vertex input and the instance storage buffer
+#define UPLOAD_DST_ACCESS (VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | \
+    VK_ACCESS_SHADER_READ_BIT)
+#define UPLOAD_DST_STAGES (VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT)
+
+static VkCommandBuffer beginUploadCommands(App *pApp, VkCommandPool commandPool){
+    VkCommandBufferAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(pApp->device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+        printf("failed to allocate upload command buffer!\n");
+        exit(20);
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    return commandBuffer;
+}
+
+// Queue family ownership transfer of a whole buffer from transferFamily to graphicsFamily
+static VkBufferMemoryBarrier uploadOwnershipBarrier(App *pApp, VkBuffer buffer,
+    VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask){
+    VkBufferMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = srcAccessMask,
+        .dstAccessMask = dstAccessMask,
+        .srcQueueFamilyIndex = pApp->queueFamilyIndices.transferFamily,
+        .dstQueueFamilyIndex = pApp->queueFamilyIndices.graphicsFamily,
+        .buffer = buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+    };
+    return barrier;
+}
+
+void uploadBuffers(App *pApp, const BufferUpload *uploads, u32 uploadCount){
+    VkDeviceSize *offsets = (VkDeviceSize *) malloc(sizeof(VkDeviceSize) * uploadCount);
+    VkDeviceSize totalSize = 0;
+    for(u32 i = 0; i < uploadCount; i++){
+        offsets[i] = totalSize;
+        totalSize += (uploads[i].size + 15) & ~(VkDeviceSize) 15;
+    }
+
+    // Staging memory is transient: it comes from the current frame's arena,
+    // which is only reset after the fence wait below has retired it.
+    VkBuffer stagingBuffer;
+    GpuAllocation stagingAllocation;
+    createBuffer(pApp, totalSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &pApp->frameArenas[pApp->currentFrame], &stagingBuffer, &stagingAllocation);
+
+    char *mapped = (char *) stagingAllocation.mapped;
+    for(u32 i = 0; i < uploadCount; i++){
+        memcpy(mapped + offsets[i], uploads[i].data, (size_t) uploads[i].size);
+    }
+
+    // With a dedicated transfer queue the copies run there, and the buffers are
+    // handed to the graphics family by a release/acquire barrier pair
+    bool transferQueue = pApp->transferQueue != VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = beginUploadCommands(pApp,
+        transferQueue ? pApp->transferCommandPool : pApp->commandPool);
+
+    for(u32 i = 0; i < uploadCount; i++){
+        VkBufferCopy copyRegion = {
+            .srcOffset = offsets[i],
+            .dstOffset = 0,
+            .size = uploads[i].size,
+        };
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, uploads[i].dst, 1, &copyRegion);
+    }
+
+    VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+    if(transferQueue){
+        VkBufferMemoryBarrier *barriers = (VkBufferMemoryBarrier *) malloc(
+            sizeof(VkBufferMemoryBarrier) * uploadCount);
+
+        // Release: the destination access mask is ignored on this side
+        for(u32 i = 0; i < uploadCount; i++){
+            barriers[i] = uploadOwnershipBarrier(pApp, uploads[i].dst, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+        }
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, NULL, uploadCount, barriers, 0, NULL);
+
+        // Acquire on the graphics queue makes the copies visible to the vertex stages
+        acquireCommandBuffer = beginUploadCommands(pApp, pApp->commandPool);
+        for(u32 i = 0; i < uploadCount; i++){
+            barriers[i] = uploadOwnershipBarrier(pApp, uploads[i].dst, 0, UPLOAD_DST_ACCESS);
+        }
+        vkCmdPipelineBarrier(acquireCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, UPLOAD_DST_STAGES,
+            0, 0, NULL, uploadCount, barriers, 0, NULL);
+        free(barriers);
+
+        if (vkEndCommandBuffer(acquireCommandBuffer) != VK_SUCCESS) {
+            printf("failed to record upload acquire command buffer!\n");
+            exit(20);
+        }
+    }else{
+        // Make the copies visible to vertex input of every later submission
+        VkMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = UPLOAD_DST_ACCESS,
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, UPLOAD_DST_STAGES,
+            0, 1, &barrier, 0, NULL, 0, NULL);
+    }
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        printf("failed to record upload command buffer!\n");
+        exit(20);
+    }
+
+    VkFenceCreateInfo fenceInfo = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    VkFence uploadFence;
+    if (vkCreateFence(pApp->device, &fenceInfo, NULL, &uploadFence) != VK_SUCCESS) {
+        printf("failed to create upload fence!\n");
+        exit(20);
+    }
+
+    VkSemaphore ownershipSemaphore = VK_NULL_HANDLE;
+    if(transferQueue){
+        VkSemaphoreCreateInfo semaphoreInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+        if (vkCreateSemaphore(pApp->device, &semaphoreInfo, NULL, &ownershipSemaphore) != VK_SUCCESS) {
+            printf("failed to create upload semaphore!\n");
+            exit(20);
+        }
+    }
+
+    VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer,
+        .signalSemaphoreCount = transferQueue ? 1 : 0,
+        .pSignalSemaphores = &ownershipSemaphore,
+    };
+
+    double submitStart = getTimeMs();
+    VkResult result;
+    if(transferQueue){
+        VkPipelineStageFlags acquireWaitStage = UPLOAD_DST_STAGES;
+        VkSubmitInfo acquireSubmitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &ownershipSemaphore,
+            .pWaitDstStageMask = &acquireWaitStage,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &acquireCommandBuffer,
+        };
+
+        result = vkQueueSubmit(pApp->transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        if(result == VK_SUCCESS)
+            result = vkQueueSubmit(pApp->graphicsQueue, 1, &acquireSubmitInfo, uploadFence);
+    }else{
+        result = vkQueueSubmit(pApp->graphicsQueue, 1, &submitInfo, uploadFence);
+    }
+    if (result != VK_SUCCESS) {
+        printf("failed to submit upload command buffer!\n");
+        exit(20);
+    }
+    double waitStart = getTimeMs();
+    vkWaitForFences(pApp->device, 1, &uploadFence, VK_TRUE, UINT64_MAX);
+    double waitEnd = getTimeMs();
+
+    statsRecord(&pApp->stats, FRAME_TIMER_UPLOAD_WAIT, waitEnd - waitStart);
+
+    // Submit to fence signal, includes queue latency so it is a lower bound on bandwidth
+    double elapsedMs = waitEnd - submitStart;
+    printf("uploaded %llu bytes in %u copies on the %s queue: %.3f ms (%.1f MB/s), fence wait %.3f ms\n",
+        (unsigned long long) totalSize, uploadCount, transferQueue ? "transfer" : "graphics", elapsedMs,
+        elapsedMs > 0.0 ? totalSize / (elapsedMs * 1000.0) : 0.0, waitEnd - waitStart);
+
+    vkDestroyFence(pApp->device, uploadFence, NULL);
+    if(transferQueue){
+        vkDestroySemaphore(pApp->device, ownershipSemaphore, NULL);
+        vkFreeCommandBuffers(pApp->device, pApp->transferCommandPool, 1, &commandBuffer);
+        vkFreeCommandBuffers(pApp->device, pApp->commandPool, 1, &acquireCommandBuffer);
+    }else{
+        vkFreeCommandBuffers(pApp->device, pApp->commandPool, 1, &commandBuffer);
+    }
+    vkDestroyBuffer(pApp->device, stagingBuffer, NULL);
+    gpuFree(&pApp->allocator, &stagingAllocation);
+    free(offsets);
+}
+
+void createStaticCommandBuffers(App *pApp){
+    for(u32 i = 0; i < pApp->windowCount; i++)
+        createWindowStaticCommandBuffers(pApp, &pApp->windows[i]);
+}
+
+void createWindowStaticCommandBuffers(App *pApp, AppWindow *pWindow){
+    if(pApp->config.recordMode != RECORD_MODE_STATIC)
+        return;
+
+    pWindow->staticCommandBufferCount = pWindow->swapChainImageCount;
+
+    VkCommandBufferAllocateInfo allocInfo= {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = pApp->commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = pWindow->staticCommandBufferCount
+    };
+
+    pWindow->staticCommandBuffers = (VkCommandBuffer *) malloc(
+        sizeof(VkCommandBuffer) * pWindow->staticCommandBufferCount
+    );
+
+    if (vkAllocateCommandBuffers(pApp->device, &allocInfo, pWindow->staticCommandBuffers) != VK_SUCCESS) {
+        printf("failed to allocate command buffers!");
+        exit(12);
+    }
+
+    // Nothing in the frame depends on anything but the image, so the commands
+    // only need recording again when the swap chain is recreated. Only the
+    // first window is timed, its slots are indexed by swap chain image.
+    for(u32 i = 0; i < pWindow->staticCommandBufferCount; i++){
+        WindowImage target = {pWindow, i};
+        u32 querySlot = pWindow->index == 0 ? i : TIMESTAMP_QUERY_SLOTS;
+        recordCommandBuffer(pApp, pWindow->staticCommandBuffers[i], &target, 1, querySlot, NULL, 0);
+    }
+}
+
+void freeStaticCommandBuffers(App *pApp){
+    for(u32 i = 0; i < pApp->windowCount; i++)
+        freeWindowStaticCommandBuffers(pApp, &pApp->windows[i]);
+}
+
+void freeWindowStaticCommandBuffers(App *pApp, AppWindow *pWindow){
+    if(pWindow->staticCommandBuffers == NULL)
+        return;
+
+    vkFreeCommandBuffers(pApp->device, pApp->commandPool, pWindow->staticCommandBufferCount,
+        pWindow->staticCommandBuffers);
+    free(pWindow->staticCommandBuffers);
+    pWindow->staticCommandBuffers = NULL;
+    pWindow->staticCommandBufferCount = 0;
+}
+
+// One render pass per target window, all timed as one.
+// secondaries: render pass contents recorded by the workers, NULL to record the draws inline
+void recordCommandBuffer(App *pApp, VkCommandBuffer commandBuffer, const WindowImage *targets, u32 targetCount,
+    u32 querySlot, const VkCommandBuffer *secondaries, u32 secondaryCount) {
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = 0, // Optional
+        .pInheritanceInfo = NULL, // Optional
+    };
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        printf("failed to begin recording command buffer!\n");
+        exit(13);
+    }
+
+    bool timed = pApp->gpuTimingSupported && querySlot < TIMESTAMP_QUERY_SLOTS;
+    if(timed){
+        vkCmdResetQueryPool(commandBuffer, pApp->timestampQueryPool, querySlot * 2, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            pApp->timestampQueryPool, querySlot * 2);
+    }
+
+    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+
+    for(u32 t = 0; t < targetCount; t++){
+        AppWindow *pWindow = targets[t].pWindow;
+        u32 imageIndex = targets[t].imageIndex;
+
+        if(pApp->config.dynamicRendering){
+            recordDynamicRendering(pApp, commandBuffer, targets[t], clearColor, secondaries, secondaryCount);
+            continue;
+        }
+
+        VkRenderPassBeginInfo renderPassInfo = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = pApp->renderPass,
+            .framebuffer = pWindow->swapChainFramebuffers[imageIndex],
+            .renderArea.offset = {0, 0},
+            .renderArea.extent = pWindow->swapChainExtent,
+            .clearValueCount = 1,
+            .pClearValues = &clearColor,
+        };
+
+        if(secondaries != NULL){
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            vkCmdExecuteCommands(commandBuffer, secondaryCount, secondaries);
+        }else{
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            if(recordDrawState(pApp, pWindow, commandBuffer))
+                recordDraws(pApp, commandBuffer, 0, pApp->drawCount);
+        }
+
+        vkCmdEndRenderPass(commandBuffer);
+    }
+
+    if(timed){
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            pApp->timestampQueryPool, querySlot * 2 + 1);
+    }
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        printf("failed to record command buffer!");
+        exit(14);
+    }
+}
+
+// Begins rendering on the frame graph's window image, which the graph has
+// already moved to COLOR_ATTACHMENT_OPTIMAL
+static void recordScenePass(void *pContext, VkCommandBuffer commandBuffer){
+    ScenePass *scene = (ScenePass *) pContext;
+    App *pApp = scene->pApp;
+    AppWindow *pWindow = scene->target.pWindow;
+
+    VkRenderingAttachmentInfoKHR colorAttachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+        .imageView = renderGraphImageView(&pApp->frameGraph, pApp->frameGraphTarget),
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .resolveMode = VK_RESOLVE_MODE_NONE,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = scene->clearColor,
+    };
+
+    VkRenderingInfoKHR renderingInfo = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+        .flags = scene->secondaries != NULL ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0,
+        .renderArea.offset = {0, 0},
+        .renderArea.extent = pWindow->swapChainExtent,
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &colorAttachment,
+    };
+
+    pApp->cmdBeginRendering(commandBuffer, &renderingInfo);
+    if(scene->secondaries != NULL){
+        vkCmdExecuteCommands(commandBuffer, scene->secondaryCount, scene->secondaries);
+    }else{
+        if(recordDrawState(pApp, pWindow, commandBuffer))
+            recordDraws(pApp, commandBuffer, 0, pApp->drawCount);
+    }
+    pApp->cmdEndRendering(commandBuffer);
+}
+
+// Renders straight into the swap chain image view. The frame graph places the
+// barriers the render pass attachment description and its external dependency did.
+void recordDynamicRendering(App *pApp, VkCommandBuffer commandBuffer, WindowImage target, VkClearValue clearColor,
+    const VkCommandBuffer *secondaries, u32 secondaryCount){
+    AppWindow *pWindow = target.pWindow;
+
+    pApp->scenePass = (ScenePass) {
+        .pApp = pApp,
+        .target = target,
+        .clearColor = clearColor,
+        .secondaries = secondaries,
+        .secondaryCount = secondaryCount,
+    };
+    renderGraphSetImage(&pApp->frameGraph, pApp->frameGraphTarget, pWindow->swapChainImages[target.imageIndex],
+        pWindow->swapChainImageViews[target.imageIndex]);
+    renderGraphExecute(&pApp->frameGraph, commandBuffer);
+}
+
+// Secondary command buffers inherit none of this, so every one binds it again.
+// Returns false when the draws must be skipped, see recordVariantState.
+bool recordDrawState(App *pApp, const AppWindow *pWindow, VkCommandBuffer commandBuffer){
+    if(!recordVariantState(pApp, commandBuffer, &pApp->drawVariant))
+        return false;
+
+    VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = (float) pWindow->swapChainExtent.width,
+        .height = (float) pWindow->swapChainExtent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {
+        .offset.x = 0,
+        .offset.y = 0,
+        .extent = pWindow->swapChainExtent,
+    };
+
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    VkBuffer vertexBuffers[] = {pApp->vertexBuffer};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, pApp->indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+    // The heap is the only set, the frame's instances are picked by slot
+    DrawPushConstants constants = {
+        .instanceBuffer = pApp->config.animate ? pApp->animatedInstanceSlots[pApp->currentFrame] : pApp->instanceSlot,
+    };
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pApp->pipelineLayout,
+        0, 1, &pApp->descriptorHeap.set, 0, NULL);
+    vkCmdPushConstants(commandBuffer, pApp->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+        0, sizeof(constants), &constants);
+    return true;
+}
+
+// Draw d covers instances [d * drawBatch, (d + 1) * drawBatch)
+void recordDraws(App *pApp, VkCommandBuffer commandBuffer, u32 firstDraw, u32 drawCount){
+    u32 batch = pApp->config.drawBatch == 0 ? pApp->instanceCount : pApp->config.drawBatch;
+
+    for(u32 d = firstDraw; d < firstDraw + drawCount; d++){
+        u32 firstInstance = d * batch;
+        u32 instanceCount = pApp->instanceCount - firstInstance < batch ?
+            pApp->instanceCount - firstInstance : batch;
+        vkCmdDrawIndexed(commandBuffer, pApp->indexCount, instanceCount, 0, 0, firstInstance);
+    }
+}
+
+void createRecordWorkers(App *pApp, u32 threadCount){
+    if(threadCount <= 1 || pApp->config.recordMode != RECORD_MODE_DYNAMIC)
+        return;
+
+    workerPoolCreate(&pApp->workerPool, threadCount);
+    pApp->recordWorkers = (RecordWorker *) calloc(threadCount, sizeof(RecordWorker));
+
+    VkCommandPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = pApp->queueFamilyIndices.graphicsFamily,
+    };
+
+    for(u32 w = 0; w < threadCount; w++){
+        RecordWorker *worker = &pApp->recordWorkers[w];
+        worker->commandPools = (VkCommandPool *) malloc(sizeof(VkCommandPool) * pApp->config.framesInFlight);
+        worker->commandBuffers = (VkCommandBuffer *) malloc(sizeof(VkCommandBuffer) * pApp->config.framesInFlight);
+
+        for(u32 f = 0; f < pApp->config.framesInFlight; f++){
+            if (vkCreateCommandPool(pApp->device, &poolInfo, NULL, &worker->commandPools[f]) != VK_SUCCESS) {
+                printf("failed to create worker command pool!\n");
+                exit(11);
+            }
+
+            VkCommandBufferAllocateInfo allocInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = worker->commandPools[f],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+
+            if (vkAllocateCommandBuffers(pApp->device, &allocInfo, &worker->commandBuffers[f]) != VK_SUCCESS) {
+                printf("failed to allocate secondary command buffer!\n");
+                exit(12);
+            }
+        }
+    }
+}
+
+// Device must be idle
+void destroyRecordWorkers(App *pApp){
+    if(pApp->recordWorkers == NULL)
+        return;
+
+    for(u32 w = 0; w < pApp->workerPool.workerCount; w++){
+        for(u32 f = 0; f < pApp->config.framesInFlight; f++){
+            vkDestroyCommandPool(pApp->device, pApp->recordWorkers[w].commandPools[f], NULL);
+        }
+        free(pApp->recordWorkers[w].commandPools);
+        free(pApp->recordWorkers[w].commandBuffers);
+    }
+    free(pApp->recordWorkers);
+    pApp->recordWorkers = NULL;
+
+    workerPoolDestroy(&pApp->workerPool);
+}
+
+static void recordWorkerJob(void *pContext, u32 workerIndex){
+    App *pApp = (App *) pContext;
+    u32 workerCount = pApp->workerPool.workerCount;
+    u32 frame = pApp->currentFrame;
+
+    // Resetting the whole pool is cheaper than resetting its one buffer; the
+    // frame timeline wait has already retired this frame's previous use.
+    vkResetCommandPool(pApp->device, pApp->recordWorkers[workerIndex].commandPools[frame], 0);
+    VkCommandBuffer commandBuffer = pApp->recordWorkers[workerIndex].commandBuffers[frame];
+
+    // With dynamic rendering there is no render pass to inherit, only the attachment formats
+    VkCommandBufferInheritanceRenderingInfoKHR inheritanceRenderingInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &pApp->swapChainImageFormat,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+
+    VkCommandBufferInheritanceInfo inheritanceInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = pApp->config.dynamicRendering ? &inheritanceRenderingInfo : NULL,
+        .renderPass = pApp->renderPass,
+        .subpass = 0,
+        .framebuffer = pApp->config.dynamicRendering ? VK_NULL_HANDLE :
+            pApp->recordTarget.pWindow->swapChainFramebuffers[pApp->recordTarget.imageIndex],
+    };
+
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritanceInfo,
+    };
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        printf("failed to begin recording secondary command buffer!\n");
+        exit(13);
+    }
+
+    u32 firstDraw = (u32) ((uint64_t) pApp->drawCount * workerIndex / workerCount);
+    u32 lastDraw = (u32) ((uint64_t) pApp->drawCount * (workerIndex + 1) / workerCount);
+    if(lastDraw > firstDraw){
+        if(recordDrawState(pApp, pApp->recordTarget.pWindow, commandBuffer))
+            recordDraws(pApp, commandBuffer, firstDraw, lastDraw - firstDraw);
+    }
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        printf("failed to record secondary command buffer!\n");
+        exit(14);
+    }
+}
+
+void recordSecondaryCommandBuffers(App *pApp, WindowImage target){
+    pApp->recordTarget = target;
+    workerPoolRun(&pApp->workerPool, recordWorkerJob, pApp);
+}
+
+
+static void finishFrameStats(App *pApp, double frameStart){
+    statsRecord(&pApp->stats, FRAME_TIMER_FRAME, getTimeMs() - frameStart);
+    if(pApp->stats.frameCount == 0)
+        finishStartupTrace(pApp);
+    pApp->stats.frameCount++;
+
+    if(pApp->config.statsInterval && pApp->stats.frameCount % pApp->config.statsInterval == 0)
+        dumpFrameStats(pApp);
+}
+
+void drawFrame(App *pApp) {
+    double frameStart = getTimeMs();
+
+    // Single host wait: the frame that last used this frame's resources
+    uint64_t frameValue = pApp->frameTimelineValue + 1;
+    if(frameValue > pApp->config.framesInFlight){
+        waitForFrameTimeline(pApp, frameValue - pApp->config.framesInFlight);
+    }
+    double waitEnd = getTimeMs();
+    statsRecord(&pApp->stats, FRAME_TIMER_WAIT_FRAME, waitEnd - frameStart);
+
+    for(u32 i = 0; i < pApp->windowCount; i++)
+        destroyRetiredSwapChains(pApp, &pApp->windows[i], false);
+    gpuLinearReset(&pApp->frameArenas[pApp->currentFrame]);
+
+    VkResult result;
+    bool headless = pApp->config.headless;
+    bool staticRecording = pApp->config.recordMode == RECORD_MODE_STATIC;
+
+    // The wait guarantees the previous use of this frame's queries has completed
+    if(!staticRecording)
+        collectGpuTiming(pApp, pApp->currentFrame);
+
+    // Windows that got an image, in window order. The rest sit this frame out.
+    WindowImage targets[MAX_WINDOWS];
+    u32 targetCount = 0;
+    u32 minimizedCount = 0;
+    for(u32 i = 0; i < pApp->windowCount; i++){
+        AppWindow *pWindow = &pApp->windows[i];
+        u32 imageIndex;
+
+        if(headless){
+            // Each frame in flight owns one offscreen image
+            imageIndex = pApp->currentFrame;
+        }else{
+            // A minimized window is retried once it reports a new size
+            if(pWindow->minimized && pWindow->framebufferResized)
+                recreateSwapChain(pApp, pWindow);
+            if(pWindow->minimized){
+                minimizedCount++;
+                continue;
+            }
+
+            result = vkAcquireNextImageKHR(pApp->device, pWindow->swapChain, UINT64_MAX, 
+                pWindow->imageAvailableSemaphores[pApp->currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapChain(pApp, pWindow);
+                continue;
+            } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+                printf("failed to acquire swap chain image!");
+                exit(15);
+            }
+        }
+
+        // A pre-recorded command buffer can't be resubmitted while an older frame
+        // that rendered to the same image is still executing it.
+        waitForFrameTimeline(pApp, pWindow->imageTimelineValues[imageIndex]);
+        pWindow->imageTimelineValues[imageIndex] = frameValue;
+        targets[targetCount++] = (WindowImage) {pWindow, imageIndex};
+    }
+    if(!headless)
+        statsRecord(&pApp->stats, FRAME_TIMER_ACQUIRE, getTimeMs() - waitEnd);
+
+    if(targetCount == 0){
+        // Nothing to draw until a window is restored
+        if(minimizedCount == pApp->windowCount)
+            glfwWaitEvents();
+        return;
+    }
+
+    // Only after a successful acquire: an early return reuses frameValue, and
+    // timeline signals must strictly increase
+    if(pApp->config.animate)
+        submitAnimation(pApp, frameValue);
+
+    // Every target window's commands, plus the capture copy
+    VkCommandBuffer submitCommandBuffers[MAX_WINDOWS + 1];
+    u32 submitCount = 0;
+    u32 querySlot;
+    if(staticRecording){
+        for(u32 t = 0; t < targetCount; t++){
+            submitCommandBuffers[submitCount++] = targets[t].pWindow->staticCommandBuffers[targets[t].imageIndex];
+        }
+        // Only the first window's buffers are timed
+        querySlot = targets[0].pWindow->index == 0 ? targets[0].imageIndex : TIMESTAMP_QUERY_SLOTS;
+        if(querySlot < TIMESTAMP_QUERY_SLOTS)
+            collectGpuTiming(pApp, querySlot);
+    }else{
+        VkCommandBuffer commandBuffer = pApp->commandBuffers[pApp->currentFrame];
+        querySlot = pApp->currentFrame;
+
+        double recordStart = getTimeMs();
+        vkResetCommandBuffer(commandBuffer, 0);
+        if(pApp->recordWorkers != NULL){
+            VkCommandBuffer secondaries[MAX_RECORD_THREADS];
+            u32 workerCount = pApp->workerPool.workerCount;
+
+            // Record workers are only created for a single window
+            recordSecondaryCommandBuffers(pApp, targets[0]);
+            for(u32 i = 0; i < workerCount; i++){
+                secondaries[i] = pApp->recordWorkers[i].commandBuffers[pApp->currentFrame];
+            }
+            recordCommandBuffer(pApp, commandBuffer, targets, 1, querySlot, secondaries, workerCount);
+        }else{
+            recordCommandBuffer(pApp, commandBuffer, targets, targetCount, querySlot, NULL, 0);
+        }
+        statsRecord(&pApp->stats, FRAME_TIMER_RECORD, getTimeMs() - recordStart);
+        submitCommandBuffers[submitCount++] = commandBuffer;
+    }
+
+    // Frames are captured from the first window
+    CaptureSlot *captureSlot = NULL;
+    if(pApp->capture.active && pApp->stats.frameCount % pApp->config.captureInterval == 0 &&
+        targets[0].pWindow->index == 0 && targets[0].pWindow->imagesCopyable)
+        captureSlot = recordCapture(pApp, targets[0], frameValue);
+    if(captureSlot != NULL)
+        submitCommandBuffers[submitCount++] = captureSlot->commandBuffer;
+    
+    VkSemaphore waitSemaphores[MAX_WINDOWS + 1];
+    VkPipelineStageFlags waitStages[MAX_WINDOWS + 1];
+    uint64_t waitValues[MAX_WINDOWS + 1];
+    u32 waitCount = 0;
+    for(u32 t = 0; !headless && t < targetCount; t++){
+        waitSemaphores[waitCount] = targets[t].pWindow->imageAvailableSemaphores[pApp->currentFrame];
+        waitStages[waitCount] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        waitValues[waitCount++] = 0; // binary semaphore, value ignored
+    }
+    if(pApp->config.animate){
+        waitSemaphores[waitCount] = pApp->computeTimeline;
+        waitStages[waitCount] = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+        waitValues[waitCount++] = frameValue;
+    }
+
+    // Headless frames only signal the timeline, there is nothing to present
+    VkSemaphore signalSemaphores[] = {pApp->frameTimeline, pApp->renderFinishedSemaphores[pApp->currentFrame]};
+    uint64_t signalValues[] = {frameValue, 0};
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = waitCount,
+        .pWaitSemaphoreValues = waitValues,
+        .signalSemaphoreValueCount = headless ? 1 : 2,
+        .pSignalSemaphoreValues = signalValues,
+    };
+    
+    VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
+        .waitSemaphoreCount = waitCount,
         .pWaitSemaphores = waitSemaphores,
         .pWaitDstStageMask = waitStages,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &pApp->commandBuffers[pApp->currentFrame],
-        .signalSemaphoreCount = 1,
+        .commandBufferCount = submitCount,
+        .pCommandBuffers = submitCommandBuffers,
+        .signalSemaphoreCount = headless ? 1 : 2,
         .pSignalSemaphores = signalSemaphores
     };
 
-    if (vkQueueSubmit(pApp->graphicsQueue, 1, &submitInfo, pApp->inFlightFences[pApp->currentFrame]) != VK_SUCCESS) {
+    double submitStart = getTimeMs();
+    if (vkQueueSubmit(pApp->graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
         printf("failed to submit draw command buffer!\n");
         exit(16);
     }
+    double submitEnd = getTimeMs();
+    statsRecord(&pApp->stats, FRAME_TIMER_SUBMIT, submitEnd - submitStart);
+    pApp->frameTimelineValue = frameValue;
+
+    if(captureSlot != NULL)
+        frameCaptureSubmit(&pApp->capture, captureSlot);
+
+    if(pApp->gpuTimingSupported && querySlot < TIMESTAMP_QUERY_SLOTS)
+        pApp->timestampQueryPending[querySlot] = true;
+
+    bool recreateDue = pApp->config.recreateInterval != 0 &&
+        (pApp->stats.frameCount + 1) % pApp->config.recreateInterval == 0;
+
+    if(headless){
+        for(u32 i = 0; recreateDue && i < pApp->windowCount; i++)
+            recreateSwapChain(pApp, &pApp->windows[i]);
+        pApp->currentFrame = (pApp->currentFrame + 1) % pApp->config.framesInFlight;
+        finishFrameStats(pApp, frameStart);
+        return;
+    }
+
+    // One present for every window, all waiting on the same semaphore
+    VkSwapchainKHR swapChains[MAX_WINDOWS];
+    u32 imageIndices[MAX_WINDOWS];
+    VkResult results[MAX_WINDOWS];
+    for(u32 t = 0; t < targetCount; t++){
+        swapChains[t] = targets[t].pWindow->swapChain;
+        imageIndices[t] = targets[t].imageIndex;
+    }
 
-    VkSwapchainKHR swapChains[] = {pApp->swapChain};
     VkPresentInfoKHR presentInfo = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = signalSemaphores,
-        .swapchainCount = 1,
+        .pWaitSemaphores = &pApp->renderFinishedSemaphores[pApp->currentFrame],
+        .swapchainCount = targetCount,
         .pSwapchains = swapChains,
-        .pImageIndices = &imageIndex,
-        .pResults = NULL // Optional
+        .pImageIndices = imageIndices,
+        .pResults = results, // per swap chain, result is the worst of them
     };
 
     result = vkQueuePresentKHR(pApp->presentQueue, &presentInfo);
+    statsRecord(&pApp->stats, FRAME_TIMER_PRESENT, getTimeMs() - submitEnd);
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || pApp->framebufferResized) {
-        pApp->framebufferResized = false;
-        recreateSwapChain(pApp);
-    } else if (result != VK_SUCCESS) {
-        printf("failed to present swap chain image!\n");
-        exit(17);
+    bool policyChanged = pApp->presentPolicyChanged;
+    pApp->presentPolicyChanged = false;
+    for(u32 t = 0; t < targetCount; t++){
+        AppWindow *pWindow = targets[t].pWindow;
+
+        if(results[t] == VK_SUCCESS || results[t] == VK_SUBOPTIMAL_KHR)
+            markRetiredSwapChainsReplaced(pWindow, frameValue);
+
+        // A suboptimal swap chain still presents, so it waits out the burst like a resize event
+        if(results[t] == VK_SUBOPTIMAL_KHR && !pWindow->framebufferResized){
+            pWindow->framebufferResized = true;
+            pWindow->resizeFirstEvent = pWindow->resizeLastEvent = getTimeMs();
+            pWindow->resizeEventCount = 0;
+        }
+        bool resizeSettled = pWindow->framebufferResized &&
+            getTimeMs() - pWindow->resizeLastEvent >= RESIZE_DEBOUNCE_MS;
+
+        if (results[t] == VK_ERROR_OUT_OF_DATE_KHR || resizeSettled || policyChanged || recreateDue) {
+            recreateSwapChain(pApp, pWindow);
+        } else if (results[t] != VK_SUCCESS && results[t] != VK_SUBOPTIMAL_KHR) {
+            printf("failed to present swap chain image!\n");
+            exit(17);
+        }
     }
     
-    pApp->currentFrame = (pApp->currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    pApp->currentFrame = (pApp->currentFrame + 1) % pApp->config.framesInFlight;
+
+    finishFrameStats(pApp, frameStart);
 }
 
-void createSyncObjects(App *pApp) {
-    pApp->imageAvailableSemaphoreCount = MAX_FRAMES_IN_FLIGHT;
-    pApp->renderFinishedSemaphoreCount = MAX_FRAMES_IN_FLIGHT;
-    pApp->inFlightFenceCount = MAX_FRAMES_IN_FLIGHT;
+void createTimestampQueries(App *pApp){
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(pApp->physicalDevice, &properties);
 
-    pApp->imageAvailableSemaphores = (VkSemaphore *) malloc(
-        sizeof(VkSemaphore) * pApp->imageAvailableSemaphoreCount);
-    pApp->renderFinishedSemaphores = (VkSemaphore *) malloc(
-        sizeof(VkSemaphore) * pApp->renderFinishedSemaphoreCount);
-    pApp->inFlightFences = (VkFence *) malloc(
-        sizeof(VkSemaphore) * pApp->inFlightFenceCount);
+    u32 queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(pApp->physicalDevice, &queueFamilyCount, NULL);
+    VkQueueFamilyProperties *queueFamilyProperties = malloc(
+        sizeof(VkQueueFamilyProperties) * queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(pApp->physicalDevice, &queueFamilyCount, queueFamilyProperties);
+
+    u32 validBits = queueFamilyProperties[pApp->queueFamilyIndices.graphicsFamily].timestampValidBits;
+    free(queueFamilyProperties);
+
+    if(validBits == 0 || properties.limits.timestampPeriod == 0.0f){
+        printf("GPU timestamps not supported, GPU frame timing disabled\n");
+        pApp->gpuTimingSupported = false;
+        return;
+    }
+
+    pApp->timestampPeriodNs = properties.limits.timestampPeriod;
+    pApp->timestampMask = validBits >= 64 ? UINT64_MAX : (((uint64_t) 1 << validBits) - 1);
+
+    VkQueryPoolCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = TIMESTAMP_QUERY_SLOTS * 2,
+    };
+
+    if(vkCreateQueryPool(pApp->device, &createInfo, NULL, &pApp->timestampQueryPool) != VK_SUCCESS){
+        printf("failed to create timestamp query pool!\n");
+        exit(18);
+    }
+    pApp->gpuTimingSupported = true;
+}
+
+// Must only be called once the submission that wrote the slot has completed
+void collectGpuTiming(App *pApp, u32 slot){
+    if(!pApp->gpuTimingSupported || !pApp->timestampQueryPending[slot])
+        return;
+
+    uint64_t timestamps[2];
+    VkResult result = vkGetQueryPoolResults(pApp->device, pApp->timestampQueryPool, slot * 2, 2,
+        sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    pApp->timestampQueryPending[slot] = false;
+
+    if(result != VK_SUCCESS)
+        return;
+
+    uint64_t ticks = (timestamps[1] - timestamps[0]) & pApp->timestampMask;
+    statsRecord(&pApp->stats, FRAME_TIMER_GPU_RENDER_PASS, ticks * pApp->timestampPeriodNs / 1000000.0);
+}
+
+void dumpFrameStats(App *pApp){
+    if(pApp->statsFile == NULL){
+        if(pApp->config.statsPath == NULL){
+            pApp->statsFile = stdout;
+        }else if((pApp->statsFile = fopen(pApp->config.statsPath, "w")) == NULL){
+            printf("failed to open stats file %s\n", pApp->config.statsPath);
+            pApp->statsFile = stdout;
+        }
+    }
+
+    statsWrite(&pApp->stats, pApp->statsFile, pApp->config.statsFormat);
+}
+
+void runHeadlessBenchmark(App *pApp){
+    u32 frameCount = pApp->config.benchmarkFrames;
+
+    printf("Rendering %u offscreen frames at %ux%u", frameCount,
+        pApp->windows[0].swapChainExtent.width, pApp->windows[0].swapChainExtent.height);
+    if(pApp->windowCount > 1)
+        printf(" to %u targets", pApp->windowCount);
+    printf("\n");
+
+    if(pApp->config.threadSweep){
+        runThreadSweep(pApp, frameCount);
+        return;
+    }
+
+    if(!pApp->config.instanceSweep){
+        benchmarkFrames(pApp, frameCount);
+        return;
+    }
+
+    u32 sweepCount = sizeof(instanceSweepCounts) / sizeof(instanceSweepCounts[0]);
+    for(u32 i = 0; i < sweepCount; i++){
+        setInstanceCount(pApp, instanceSweepCounts[i]);
+        benchmarkFrames(pApp, frameCount);
+    }
+}
+
+// Recording time per frame for 1, 2, 4, ... threads, up to the core count
+void runThreadSweep(App *pApp, u32 frameCount){
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 maxThreads = cores < 1 ? 1 : (cores > MAX_RECORD_THREADS ? MAX_RECORD_THREADS : (u32) cores);
+
+    printf("Recording %u draws per frame\n", pApp->drawCount);
+
+    double baseline = 0.0;
+    u32 threads = 1;
+    for(;;){
+        vkDeviceWaitIdle(pApp->device);
+        destroyRecordWorkers(pApp);
+        createRecordWorkers(pApp, threads);
+
+        statsReset(&pApp->stats);
+        benchmarkFrames(pApp, frameCount);
+
+        TimerSummary record = statsSummarize(&pApp->stats, FRAME_TIMER_RECORD);
+        if(threads == 1)
+            baseline = record.p50;
+        printf("%u record threads: record p50 %.3f ms, p95 %.3f ms, speedup %.2fx\n", threads,
+            record.p50, record.p95, record.p50 > 0.0 ? baseline / record.p50 : 0.0);
+
+        if(threads >= maxThreads)
+            break;
+        threads = threads * 2 < maxThreads ? threads * 2 : maxThreads;
+    }
+}
+
+// Returns frames/sec
+double benchmarkFrames(App *pApp, u32 frameCount){
+    double start = getTimeMs();
+    for(u32 i = 0; i < frameCount; i++){
+        drawFrame(pApp);
+    }
+    vkDeviceWaitIdle(pApp->device);
+    double elapsed = getTimeMs() - start;
+
+    double framesPerSec = frameCount * 1000.0 / elapsed;
+    double trianglesPerSec = framesPerSec * (pApp->indexCount / 3) * (double) pApp->instanceCount;
+
+    printf("%u instances, %u frames in %.2f ms: %.1f frames/sec (%.3f ms/frame), %.1f Mtriangles/sec\n",
+        pApp->instanceCount, frameCount, elapsed, framesPerSec, elapsed / frameCount, trianglesPerSec / 1e6);
+    return framesPerSec;
+}
 
+void createSyncObjects(App *pApp) {
+    pApp->renderFinishedSemaphores = (VkSemaphore *) malloc(
+        sizeof(VkSemaphore) * pApp->config.framesInFlight);
 
     VkSemaphoreCreateInfo semaphoreInfo = {
         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
     };
-    
-    VkFenceCreateInfo fenceInfo = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT
-    };
 
-    for(u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
-        if (vkCreateSemaphore(pApp->device, &semaphoreInfo, NULL, &pApp->imageAvailableSemaphores[i]) != VK_SUCCESS ||
-        vkCreateSemaphore(pApp->device, &semaphoreInfo, NULL, &pApp->renderFinishedSemaphores[i]) != VK_SUCCESS ||
-        vkCreateFence(pApp->device, &fenceInfo, NULL, &pApp->inFlightFences[i]) != VK_SUCCESS) {
+    for(u32 i = 0; i < pApp->config.framesInFlight; i++){
+        if (vkCreateSemaphore(pApp->device, &semaphoreInfo, NULL, &pApp->renderFinishedSemaphores[i]) != VK_SUCCESS) {
            printf("failed to create synchronization objects for a frame!\n");
            exit(17);
         }
     }
+
+    // Acquires are per window, the submission waits on one semaphore of each target
+    for(u32 w = 0; w < pApp->windowCount; w++){
+        AppWindow *pWindow = &pApp->windows[w];
+        pWindow->imageAvailableSemaphores = (VkSemaphore *) malloc(
+            sizeof(VkSemaphore) * pApp->config.framesInFlight);
+        pWindow->imageTimelineValues = (uint64_t *) calloc(pWindow->swapChainImageCount, sizeof(uint64_t));
+
+        for(u32 i = 0; i < pApp->config.framesInFlight; i++){
+            if (vkCreateSemaphore(pApp->device, &semaphoreInfo, NULL, &pWindow->imageAvailableSemaphores[i]) != VK_SUCCESS) {
+               printf("failed to create synchronization objects for a frame!\n");
+               exit(17);
+            }
+        }
+    }
+
+    VkSemaphoreTypeCreateInfo timelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    VkSemaphoreCreateInfo timelineSemaphoreInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &timelineInfo,
+    };
+
+    if (vkCreateSemaphore(pApp->device, &timelineSemaphoreInfo, NULL, &pApp->frameTimeline) != VK_SUCCESS) {
+        printf("failed to create frame timeline semaphore!\n");
+        exit(17);
+    }
+    pApp->frameTimelineValue = 0;
+}
+
+// Passes of a dynamic rendering frame and the images they use. With a render
+// pass, its attachment description and subpass dependency do this instead.
+void createFrameGraph(App *pApp){
+    if(!pApp->config.dynamicRendering)
+        return;
+
+    RenderGraph *graph = &pApp->frameGraph;
+    renderGraphInit(graph, pApp->device, &pApp->allocator, pApp->cmdPipelineBarrier2);
+
+    // Handed over in COLOR_ATTACHMENT_OUTPUT, where the acquire semaphore wait and
+    // the capture copy barrier sit. The old contents are cleared, so UNDEFINED lets
+    // the driver skip preserving them. Offscreen targets end up ready to be copied.
+    VkImageLayout finalLayout = pApp->config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                      : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    pApp->frameGraphTarget = renderGraphImportImage(graph, "window", VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+        finalLayout, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR);
+
+    u32 scene = renderGraphAddPass(graph, "scene", false, recordScenePass, &pApp->scenePass);
+    renderGraphWrite(graph, scene, pApp->frameGraphTarget, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+    if(renderGraphCompile(graph) != VK_SUCCESS){
+        printf("failed to compile frame graph!\n");
+        exit(23);
+    }
+    renderGraphWriteStats(graph, stdout);
 }
 
-void recreateSwapChain(App *pApp){
+void createCapture(App *pApp){
+    if(pApp->config.captureDir == NULL)
+        return;
 
-    int width = 0, height = 0;
+    VkFormat format = pApp->swapChainImageFormat;
+    if(format != VK_FORMAT_R8G8B8A8_UNORM && format != VK_FORMAT_R8G8B8A8_SRGB &&
+        format != VK_FORMAT_B8G8R8A8_UNORM && format != VK_FORMAT_B8G8R8A8_SRGB){
+        printf("frame capture needs an 8-bit RGBA or BGRA format, capture disabled\n");
+        return;
+    }
 
-    glfwGetFramebufferSize(pApp->window, &width, &height);
+    for(u32 i = 0; i < CAPTURE_RING_SIZE; i++){
+        VkCommandBufferAllocateInfo allocInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pApp->commandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
 
-    while (width == 0 || height == 0) {
-        glfwGetFramebufferSize(pApp->window, &width, &height);
-        glfwWaitEvents();
+        if (vkAllocateCommandBuffers(pApp->device, &allocInfo, &pApp->capture.slots[i].commandBuffer) != VK_SUCCESS) {
+            printf("failed to allocate capture command buffer!\n");
+            exit(12);
+        }
     }
 
-    vkDeviceWaitIdle(pApp->device);
+    frameCaptureStart(&pApp->capture, pApp->device, pApp->frameTimeline, pApp->config.captureDir);
+}
+
+// Records the copy of the target image into the next free readback buffer. It is
+// submitted right after the frame's command buffer, so it runs once the
+// render pass is done. NULL when the writer still holds every slot.
+CaptureSlot *recordCapture(App *pApp, WindowImage target, uint64_t frameValue){
+    CaptureSlot *slot = frameCaptureAcquire(&pApp->capture);
+    if(slot == NULL)
+        return NULL;
+
+    VkExtent2D extent = target.pWindow->swapChainExtent;
+    VkImage image = target.pWindow->swapChainImages[target.imageIndex];
+    VkDeviceSize size = (VkDeviceSize) extent.width * extent.height * 4;
+
+    // The slot is free, so the GPU and the writer are done with its buffer
+    if(slot->capacity < size){
+        if(slot->buffer != VK_NULL_HANDLE){
+            vkDestroyBuffer(pApp->device, slot->buffer, NULL);
+            gpuFree(&pApp->allocator, &slot->allocation);
+        }
+
+        // Cached memory keeps the writer's reads fast
+        u32 memoryTypeIndex;
+        VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        if(gpuFindMemoryType(&pApp->allocator, ~0u, properties | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, &memoryTypeIndex))
+            properties |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+        createBuffer(pApp, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties, NULL,
+            &slot->buffer, &slot->allocation);
+        slot->capacity = size;
+    }
+
+    slot->timelineValue = frameValue;
+    slot->frame = pApp->stats.frameCount;
+    slot->width = extent.width;
+    slot->height = extent.height;
+    slot->bgra = pApp->swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM ||
+        pApp->swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+
+    VkCommandBuffer commandBuffer = slot->commandBuffer;
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    // Offscreen targets already end the render pass in TRANSFER_SRC_OPTIMAL
+    VkImageLayout finalLayout = pApp->config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                      : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkImageMemoryBarrier imageBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = finalLayout,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+
+    VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0, // tightly packed
+        .bufferImageHeight = 0,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {extent.width, extent.height, 1},
+    };
+    vkCmdCopyImageToBuffer(commandBuffer, image,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+    // Back to where the render pass left it, and make the copy visible to the writer
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.dstAccessMask = 0;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = finalLayout;
+
+    VkBufferMemoryBarrier bufferBarrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = slot->buffer,
+        .offset = 0,
+        .size = size,
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        0, NULL, 1, &bufferBarrier, 1, &imageBarrier);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        printf("failed to record capture command buffer!\n");
+        exit(14);
+    }
+
+    return slot;
+}
+
+// Waits for the writer to drain, then frees the readback buffers
+void destroyCapture(App *pApp){
+    if(!pApp->capture.active)
+        return;
+
+    FrameCapture *capture = &pApp->capture;
+    frameCaptureStop(capture);
+
+    printf("captured %llu frames to %s (%.3f ms each to write), dropped %llu\n",
+        (unsigned long long) capture->written, pApp->config.captureDir,
+        capture->written > 0 ? capture->writeMs / capture->written : 0.0,
+        (unsigned long long) capture->dropped);
+
+    for(u32 i = 0; i < CAPTURE_RING_SIZE; i++){
+        CaptureSlot *slot = &capture->slots[i];
+        if(slot->buffer != VK_NULL_HANDLE){
+            vkDestroyBuffer(pApp->device, slot->buffer, NULL);
+            gpuFree(&pApp->allocator, &slot->allocation);
+        }
+        vkFreeCommandBuffers(pApp->device, pApp->commandPool, 1, &slot->commandBuffer);
+    }
+}
+
+void waitForFrameTimeline(App *pApp, uint64_t value){
+    if(value == 0)
+        return;
+
+    VkSemaphoreWaitInfo waitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &pApp->frameTimeline,
+        .pValues = &value,
+    };
+
+    if(vkWaitSemaphores(pApp->device, &waitInfo, UINT64_MAX) != VK_SUCCESS){
+        printf("failed to wait for frame timeline!\n");
+        exit(17);
+    }
+}
+
+void recreateSwapChain(App *pApp, AppWindow *pWindow){
+    double start = getTimeMs();
+
+    // Offscreen targets have a fixed size, recreating them only exercises the path.
+    // A minimized window keeps its swap chain and is skipped until it is resized,
+    // so the other windows keep rendering.
+    if(!pApp->config.headless){
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(pWindow->window, &width, &height);
+        pWindow->minimized = width == 0 || height == 0;
+        if(pWindow->minimized){
+            pWindow->framebufferResized = false;
+            return;
+        }
+    }
+
+    // No device drain: frames already submitted keep rendering into the old
+    // resources, which are destroyed once the frame timeline passes them.
+    // pWindow->swapChain stays valid until createWindowSwapChain hands it over as oldSwapchain.
+    // Completed retirements are destroyed first so their arrays can be reused.
+    destroyRetiredSwapChains(pApp, pWindow, false);
+    u32 oldImageCount = pWindow->swapChainImageCount;
+    retireSwapChain(pApp, pWindow);
+
+    createWindowSwapChain(pApp, pWindow);
+    createWindowImageViews(pApp, pWindow);
+    createWindowFramebuffers(pApp, pWindow);
+
+    // Images of the new swap chain have not been rendered to yet
+    if(pWindow->swapChainImageCount != oldImageCount){
+        free(pWindow->imageTimelineValues);
+        pWindow->imageTimelineValues = (uint64_t *) calloc(pWindow->swapChainImageCount, sizeof(uint64_t));
+    }else{
+        memset(pWindow->imageTimelineValues, 0, sizeof(uint64_t) * pWindow->swapChainImageCount);
+    }
+
+    // Static query slots are reused by the first window's new command buffers,
+    // drop results of old frames that may still be in flight
+    if(pApp->config.recordMode == RECORD_MODE_STATIC && pWindow->index == 0){
+        memset(pApp->timestampQueryPending, 0, sizeof(pApp->timestampQueryPending));
+    }
+    createWindowStaticCommandBuffers(pApp, pWindow);
+
+    double end = getTimeMs();
+    statsRecord(&pApp->stats, FRAME_TIMER_RECREATE, end - start);
+
+    // Also reached through an out of date swap chain before the burst settled
+    if(pWindow->framebufferResized){
+        pWindow->framebufferResized = false;
+        statsRecord(&pApp->stats, FRAME_TIMER_RESIZE_LATENCY, end - pWindow->resizeFirstEvent);
+        printf("window %u resized to %ux%u: %u resize events, recreated in %.3f ms, %.3f ms after the first\n",
+            pWindow->index, pWindow->swapChainExtent.width, pWindow->swapChainExtent.height,
+            pWindow->resizeEventCount, end - start, end - pWindow->resizeFirstEvent);
+    }
+}
+
+void retireSwapChain(App *pApp, AppWindow *pWindow){
+    // Queue full, e.g. recreated again and again without a present in between:
+    // fall back to draining the device and the presentation of every entry
+    if(pWindow->retiredSwapChainCount == MAX_RETIRED_SWAPCHAINS){
+        vkDeviceWaitIdle(pApp->device);
+        destroyRetiredSwapChains(pApp, pWindow, true);
+    }
+
+    pWindow->retiredSwapChains[pWindow->retiredSwapChainCount++] = (RetiredSwapChain) {
+        .retireValue = pApp->frameTimelineValue,
+        .swapChain = pWindow->swapChain,
+        .arrays = {
+            .images = pWindow->swapChainImages,
+            .imageViews = pWindow->swapChainImageViews,
+            .framebuffers = pWindow->swapChainFramebuffers,
+            .imageAllocations = pWindow->offscreenImageAllocations,
+            .imageCount = pWindow->swapChainImageCount,
+        },
+        .staticCommandBuffers = pWindow->staticCommandBuffers,
+        .staticCommandBufferCount = pWindow->staticCommandBufferCount,
+    };
+
+    pWindow->offscreenImageAllocations = NULL;
+    pWindow->swapChainImages = NULL;
+    pWindow->swapChainImageViews = NULL;
+    pWindow->swapChainFramebuffers = NULL;
+    pWindow->staticCommandBuffers = NULL;
+    pWindow->staticCommandBufferCount = 0;
+}
+
+// A present on the new swap chain was queued after every present of the retired
+// one
+void markRetiredSwapChainsReplaced(AppWindow *pWindow, uint64_t frameValue){
+    for(u32 i = 0; i < pWindow->retiredSwapChainCount; i++){
+        if(pWindow->retiredSwapChains[i].replacementPresentValue == 0)
+            pWindow->retiredSwapChains[i].replacementPresentValue = frameValue;
+    }
+}
+
+// Destroys retired swap chains whose frames have completed, or all of them
+// when waitAll is set and the device is idle. The frame timeline only covers
+// rendering, not the presentation of the last images, so a swap chain is kept
+// until a later present on its replacement has been queued and its frame has
+// completed too (VK_EXT_swapchain_maintenance1 present fences would be exact,
+// but it isn't widely available).
+void destroyRetiredSwapChains(App *pApp, AppWindow *pWindow, bool waitAll){
+    if(pWindow->retiredSwapChainCount == 0)
+        return;
+
+    uint64_t completed = UINT64_MAX;
+    if(!waitAll && vkGetSemaphoreCounterValue(pApp->device, pApp->frameTimeline, &completed) != VK_SUCCESS){
+        printf("failed to query frame timeline!\n");
+        exit(17);
+    }
+
+    u32 destroyed = 0;
+    while(destroyed < pWindow->retiredSwapChainCount){
+        RetiredSwapChain *retired = &pWindow->retiredSwapChains[destroyed];
+        if(retired->retireValue > completed)
+            break;
+        if(!waitAll && retired->swapChain != VK_NULL_HANDLE &&
+            (retired->replacementPresentValue == 0 || retired->replacementPresentValue > completed))
+            break;
 
-    cleanupSwapChain(pApp);
+        if(retired->staticCommandBuffers != NULL){
+            vkFreeCommandBuffers(pApp->device, pApp->commandPool, retired->staticCommandBufferCount,
+                retired->staticCommandBuffers);
+            free(retired->staticCommandBuffers);
+        }
+
+        SwapChainArrays *arrays = &retired->arrays;
+        for(u32 i = 0; i < arrays->imageCount; i++){
+            if(arrays->framebuffers != NULL)
+                vkDestroyFramebuffer(pApp->device, arrays->framebuffers[i], NULL);
+            vkDestroyImageView(pApp->device, arrays->imageViews[i], NULL);
+            if(arrays->imageAllocations != NULL){
+                vkDestroyImage(pApp->device, arrays->images[i], NULL);
+                gpuFree(&pApp->allocator, &arrays->imageAllocations[i]);
+            }
+        }
+        recycleSwapChainArrays(pWindow, arrays);
 
-    createSwapChain(pApp);
-    createImageViews(pApp);
-    createFramebuffers(pApp);
+        if(retired->swapChain != VK_NULL_HANDLE)
+            vkDestroySwapchainKHR(pApp->device, retired->swapChain, NULL);
+        destroyed++;
+    }
+
+    pWindow->retiredSwapChainCount -= destroyed;
+    memmove(pWindow->retiredSwapChains, pWindow->retiredSwapChains + destroyed,
+        sizeof(RetiredSwapChain) * pWindow->retiredSwapChainCount);
 }
 
-void cleanupSwapChain(App *pApp) {
-    for (u32 i = 0; i < pApp->swapChainImageCount; i++) {
-        vkDestroyFramebuffer(pApp->device, pApp->swapChainFramebuffers[i], NULL);
+void cleanupSwapChain(App *pApp, AppWindow *pWindow) {
+    for (u32 i = 0; pWindow->swapChainFramebuffers != NULL && i < pWindow->swapChainImageCount; i++) {
+        vkDestroyFramebuffer(pApp->device, pWindow->swapChainFramebuffers[i], NULL);
+    }
+
+    for (u32 i = 0; i < pWindow->swapChainImageCount; i++) {
+        vkDestroyImageView(pApp->device, pWindow->swapChainImageViews[i], NULL);
     }
 
-    for (u32 i = 0; i < pApp->swapChainImageCount; i++) {
-        vkDestroyImageView(pApp->device, pApp->swapChainImageViews[i], NULL);
+    if(pApp->config.headless){
+        for (u32 i = 0; i < pWindow->swapChainImageCount; i++) {
+            vkDestroyImage(pApp->device, pWindow->swapChainImages[i], NULL);
+            gpuFree(&pApp->allocator, &pWindow->offscreenImageAllocations[i]);
+        }
+    }else{
+        vkDestroySwapchainKHR(pApp->device, pWindow->swapChain, NULL);
     }
 
-    vkDestroySwapchainKHR(pApp->device, pApp->swapChain, NULL);
+    SwapChainArrays arrays = {
+        .images = pWindow->swapChainImages,
+        .imageViews = pWindow->swapChainImageViews,
+        .framebuffers = pWindow->swapChainFramebuffers,
+        .imageAllocations = pWindow->offscreenImageAllocations,
+    };
+    freeSwapChainArrays(&arrays);
+    freeSwapChainArrays(&pWindow->spareSwapChainArrays);
 }
 
 
+// Only notes the event, drawFrame recreates once the burst is over
 static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
-    App* app = (App *) glfwGetWindowUserPointer(window);
-    app->framebufferResized = true;
+    AppWindow* appWindow = (AppWindow *) glfwGetWindowUserPointer(window);
+    double now = getTimeMs();
+    if(!appWindow->framebufferResized){
+        appWindow->framebufferResized = true;
+        appWindow->resizeFirstEvent = now;
+        appWindow->resizeEventCount = 0;
+    }
+    appWindow->resizeLastEvent = now;
+    appWindow->resizeEventCount++;
+}
+
+// P cycles the present policy, applied by recreating the swap chain after the next present
+static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if(key != GLFW_KEY_P || action != GLFW_PRESS)
+        return;
+
+    App* app = ((AppWindow *) glfwGetWindowUserPointer(window))->pApp;
+    app->config.presentPolicy = (PresentPolicy) ((app->config.presentPolicy + 1) % PRESENT_POLICY_COUNT);
+    app->presentPolicyChanged = true;
 }
\ No newline at end of file
@@ -6,17 +6,38 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan.h>
 
+#include "stats.h"
+#include "allocator.h"
+#include "workers.h"
+#include "capture.h"
+#include "graph.h"
+#include "bindless.h"
+
 
 /* Structs definitions */
 
 typedef uint32_t u32;
 typedef uint8_t u8;
 
+#define TIMESTAMP_QUERY_SLOTS 16
+#define MAX_RETIRED_SWAPCHAINS 8
+#define RESIZE_DEBOUNCE_MS 50.0
+#define MAX_WINDOWS 4
+#define MAX_RECORD_THREADS 64
+#define MAX_COMPILE_THREADS 32
+#define SHADER_PATH_MAX 4096
+#define MAX_STARTUP_PHASES 32
+#define MAX_INIT_THREADS 8
+#define SPIRV_MAGIC 0x07230203u
+#define BINDLESS_MAX_BUFFERS 1024 // clamped to the update-after-bind limits
+#define BINDLESS_MAX_IMAGES 1024
+
 typedef struct SwapChainSupportDetails {
     VkSurfaceCapabilitiesKHR capabilities;
     VkSurfaceFormatKHR *formats;
@@ -25,64 +46,425 @@ typedef struct SwapChainSupportDetails {
     u32 presentModeCount;
 } SwapChainSupportDetails;
 
+typedef struct Vertex {
+    float pos[2];
+    float color[3];
+} Vertex;
+
+// std430 layout of the Instance struct in shader.vert
+typedef struct InstanceData {
+    float offset[2];
+    float scale;
+    float pad;
+    float color[4];
+} InstanceData;
+
+// Matches the push constant block of shader.comp
+typedef struct AnimationPushConstants {
+    float time; // seconds since createAnimation
+    u32 instanceCount;
+    u32 side; // grid cells per row
+    u32 instanceBuffer; // bindless slot of the buffer written
+} AnimationPushConstants;
+
+// Matches the push constant block of shader.vert
+typedef struct DrawPushConstants {
+    u32 instanceBuffer; // bindless slot of the instances drawn
+} DrawPushConstants;
+
+// One staging copy into a device-local buffer, see uploadBuffers
+typedef struct BufferUpload {
+    VkBuffer dst;
+    const void *data;
+    VkDeviceSize size;
+} BufferUpload;
+
 typedef struct QueueFamilyIndices{
     u32 graphicsFamily;
     u32 presentFamily;
+    u32 transferFamily; // no graphics bit, transfer-only when the device has one
+    u32 computeFamily;  // compute without graphics: async compute
     bool isGraphicsFamilySet;
     bool isPresentFamilySet;
+    bool isTransferFamilySet;
+    bool isComputeFamilySet;
 } QueueFamilyIndices;
 
-typedef struct App {
+typedef enum RecordMode {
+    RECORD_MODE_STATIC,  // one command buffer per swap chain image, recorded on (re)creation
+    RECORD_MODE_DYNAMIC, // re-recorded every frame for content that changes
+} RecordMode;
+
+typedef enum PresentPolicy {
+    PRESENT_POLICY_IMMEDIATE,    // uncapped, may tear: benchmarking
+    PRESENT_POLICY_MAILBOX,      // low latency without tearing
+    PRESENT_POLICY_FIFO,         // vsync: lowest power
+    PRESENT_POLICY_FIFO_RELAXED, // vsync, tears instead of stalling on late frames
+    PRESENT_POLICY_COUNT
+} PresentPolicy;
+
+typedef struct AppConfig {
+    bool headless; // render into offscreen images, no window or surface
+    u32 benchmarkFrames;
+    const char *pipelineCachePath;
+    RecordMode recordMode;
+    u32 framesInFlight;
+    PresentPolicy presentPolicy;
+    u32 instanceCount;
+    bool instanceSweep; // headless: benchmark 10^5, 10^6 and 10^7 instances
+    u32 drawBatch; // instances per draw call, 0: a single draw
+    u32 recordThreads;
+    bool threadSweep; // headless: benchmark recording with 1, 2, 4, ... threads
+    u32 compileThreads;
+    u32 initThreads; // 1: every init stage in order on the main thread
+    bool animate; // instances are written by a compute pass every frame
+    const char *captureDir; // NULL: no frame capture
+    u32 captureInterval; // capture every N-th frame
+    u32 recreateInterval; // recreate the swap chain every N frames, 0: only when needed
+    bool dynamicRendering; // VK_KHR_dynamic_rendering, no render pass or framebuffers
+    bool bakedVariants; // bake every variant axis, ignore extended dynamic state
+    // Pipeline variant every draw uses, indices into the variant axes
+    u32 variantTopology;
+    u32 variantCullMode;
+    u32 variantBlendMode; // BlendMode
+    u32 variantBrightness;
+    u32 windowCount; // windows (offscreen views when headless), each with its own swap chain
+    const char *shaderDir; // NULL: shaders/ next to the executable
+    const char *startupTracePath; // NULL: only the breakdown on stdout
+
+    const char *statsPath; // NULL: stdout
+    StatsFormat statsFormat;
+    u32 statsInterval; // dump every N frames, 0: only on exit
+} AppConfig;
+
+// Per-image arrays of a swap chain. Once its swap chain is destroyed a set is
+// kept as the spare and handed to the next swap chain with the same image count.
+typedef struct SwapChainArrays {
+    VkImage *images;
+    VkImageView *imageViews;
+    VkFramebuffer *framebuffers; // NULL with dynamic rendering
+    GpuAllocation *imageAllocations; // headless: images are ours to destroy
+    u32 imageCount;
+} SwapChainArrays;
+
+// Swap chain resources replaced by a recreation, destroyed once the frame
+// timeline reaches retireValue (the last frame submitted against them) and,
+// for a real swap chain, replacementPresentValue
+typedef struct RetiredSwapChain {
+    uint64_t retireValue;
+    uint64_t replacementPresentValue; // first frame presented after it, 0 until then
+    VkSwapchainKHR swapChain; // VK_NULL_HANDLE when headless
+    SwapChainArrays arrays;
+    VkCommandBuffer *staticCommandBuffers;
+    u32 staticCommandBufferCount;
+} RetiredSwapChain;
+
+typedef enum BlendMode {
+    BLEND_MODE_OPAQUE,
+    BLEND_MODE_ALPHA,
+    BLEND_MODE_ADDITIVE,
+    BLEND_MODE_COUNT
+} BlendMode;
+
+typedef struct shaderFile{
+    size_t size;
+    const u32 *code;
+    bool mapped; // false for SPIR-V embedded in the binary
+} shaderFile;
+
+typedef struct StartupPhase {
+    const char *name;
+    double start; // ms since process start
+    double ms;
+    u32 thread; // init worker index, 0 is the main thread
+} StartupPhase;
+
+// Init stages, in the order a single init thread runs them. Every stage
+// lists the stages whose handles it reads, see initStages in vulkan.c.
+typedef enum InitStageId {
+    INIT_GLFW,
+    INIT_WINDOW,
+    INIT_LOAD_SHADERS,
+    INIT_LOAD_PIPELINE_CACHE_FILE,
+    INIT_INSTANCE,
+    INIT_DEBUG_MESSENGER,
+    INIT_SURFACE,
+    INIT_PHYSICAL_DEVICE,
+    INIT_LOGICAL_DEVICE,
+    INIT_ALLOCATOR,
+    INIT_SWAP_CHAIN,
+    INIT_IMAGE_VIEWS,
+    INIT_RENDER_PASS,
+    INIT_PIPELINE_CACHE,
+    INIT_DESCRIPTOR_HEAP,
+    INIT_GRAPHICS_PIPELINE,
+    INIT_FRAMEBUFFERS,
+    INIT_COMMAND_POOL,
+    INIT_COMMAND_BUFFERS,
+    INIT_GEOMETRY_BUFFERS,
+    INIT_INSTANCE_BUFFER,
+    INIT_INSTANCE_DESCRIPTOR,
+    INIT_COMPUTE_PIPELINE,
+    INIT_ANIMATION,
+    INIT_TIMESTAMP_QUERIES,
+    INIT_RECORD_WORKERS,
+    INIT_FRAME_GRAPH,
+    INIT_STATIC_COMMAND_BUFFERS,
+    INIT_SYNC_OBJECTS,
+    INIT_CAPTURE,
+    INIT_STAGE_COUNT
+} InitStageId;
+
+struct App;
+
+typedef struct InitStage {
+    const char *name;
+    void (*function)(struct App *pApp);
+    uint64_t dependencies; // INIT_DEP bits
+    bool mainThread; // GLFW window calls must stay on the main thread
+} InitStage;
+
+// Shared by the init workers, mutex guards the masks and startupPhases
+typedef struct InitScheduler {
+    struct App *pApp;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    uint64_t started;
+    uint64_t finished;
+} InitScheduler;
+
+typedef struct PipelineVariantKey {
+    VkPrimitiveTopology topology;
+    VkCullModeFlags cullMode;
+    BlendMode blendMode;
+    float brightness; // specialization constant
+} PipelineVariantKey;
+
+typedef struct PipelineVariant {
+    PipelineVariantKey key;
+    VkPipeline pipeline;
+    bool required; // needed for the first frame
+    bool ready;
+} PipelineVariant;
+
+// Variant axes set while recording instead of baked into the pipeline. Keys
+// of the variant registry hold the default value for every dynamic axis.
+typedef struct ExtendedDynamicState {
+    bool cullTopology; // VK_EXT_extended_dynamic_state: cull mode, front face, topology
+    bool topologyUnrestricted; // topology may change class, e.g. triangles to lines
+    bool blend; // VK_EXT_extended_dynamic_state3: blend enable and equation
+    PFN_vkCmdSetCullModeEXT setCullMode;
+    PFN_vkCmdSetFrontFaceEXT setFrontFace;
+    PFN_vkCmdSetPrimitiveTopologyEXT setPrimitiveTopology;
+    PFN_vkCmdSetColorBlendEnableEXT setColorBlendEnable;
+    PFN_vkCmdSetColorBlendEquationEXT setColorBlendEquation;
+} ExtendedDynamicState;
+
+// Variants are compiled on their own threads; mutex guards everything
+// below it, requiredReady is signaled once requiredRemaining drops to 0.
+typedef struct PipelineCompiler {
+    PipelineVariant *variants;
+    u32 variantCount;
+    pthread_t *threads;
+    u32 threadCount;
+    double start;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t requiredReady;
+    u32 nextVariant;
+    u32 compiledCount;
+    u32 requiredRemaining;
+} PipelineCompiler;
+
+// RECORD_MODE_DYNAMIC with several record threads: each worker owns a command
+// pool per frame in flight and records its slice of the draws into a secondary
+typedef struct RecordWorker {
+    VkCommandPool *commandPools;
+    VkCommandBuffer *commandBuffers;
+} RecordWorker;
+
+// One window and its swap chain. All windows share the device, the pipelines
+// and the frame: they are recorded into one submission and presented together.
+typedef struct AppWindow {
+    struct App *pApp; // for GLFW callbacks
+    u32 index;
     GLFWwindow *window;
+    VkSurfaceKHR surface;
+
+    VkSwapchainKHR swapChain;
+    VkImage *swapChainImages;
+    u32 swapChainImageCount;
+    VkExtent2D swapChainExtent;
+    bool imagesCopyable; // TRANSFER_SRC usage, frame capture copies from them
+    VkPresentModeKHR presentMode;
+    VkImageView *swapChainImageViews;
+    VkFramebuffer *swapChainFramebuffers; // NULL with dynamic rendering
+
+    // Headless mode: offscreen render targets stand in for the swap chain images
+    GpuAllocation *offscreenImageAllocations;
+
+    // RECORD_MODE_STATIC: pre-recorded, indexed by swap chain image
+    VkCommandBuffer *staticCommandBuffers;
+    u32 staticCommandBufferCount;
+
+    // Oldest first, drained at the start of each frame
+    RetiredSwapChain retiredSwapChains[MAX_RETIRED_SWAPCHAINS];
+    u32 retiredSwapChainCount;
+    SwapChainArrays spareSwapChainArrays; // images NULL: no spare
+
+    VkSemaphore *imageAvailableSemaphores; // one per frame in flight
+    uint64_t *imageTimelineValues; // frame that last rendered each swap chain image
+
+    // Resize events are coalesced: the swap chain is recreated once none has
+    // arrived for RESIZE_DEBOUNCE_MS, or right away when it is out of date
+    bool framebufferResized;
+    double resizeFirstEvent; // ms, first event of the pending burst
+    double resizeLastEvent;
+    u32 resizeEventCount;
+    bool minimized; // zero sized: skipped until it is resized again
+} AppWindow;
+
+// A window and the swap chain image it renders to in the current frame
+typedef struct WindowImage {
+    AppWindow *pWindow;
+    u32 imageIndex;
+} WindowImage;
+
+// What the frame graph's scene pass records, set before every execution
+typedef struct ScenePass {
+    struct App *pApp;
+    WindowImage target;
+    VkClearValue clearColor;
+    const VkCommandBuffer *secondaries; // NULL: draws recorded inline
+    u32 secondaryCount;
+} ScenePass;
+
+typedef struct App {
+    AppConfig config;
+
+    double processStart; // getTimeMs() on entering main
+    StartupPhase startupPhases[MAX_STARTUP_PHASES];
+    u32 startupPhaseCount;
+
+    AppWindow windows[MAX_WINDOWS];
+    u32 windowCount;
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
-    VkSurfaceKHR surface;
     VkPhysicalDevice physicalDevice;
     QueueFamilyIndices queueFamilyIndices;
     VkDevice device; //Logical Device
     VkQueue graphicsQueue;
     VkQueue presentQueue;
-    
-    VkSwapchainKHR swapChain;
-    VkImage *swapChainImages;
-    u32 swapChainImageCount;
-    VkFormat swapChainImageFormat;
-    VkExtent2D swapChainExtent;
-
-    VkImageView *swapChainImageViews;
+    VkQueue transferQueue; // VK_NULL_HANDLE: uploads go through graphicsQueue
+    VkQueue computeQueue;  // VK_NULL_HANDLE: no async compute family
 
-    VkRenderPass renderPass;
+    GpuAllocator allocator;
+    // Host visible transient memory, reset once the frame's timeline value is reached
+    GpuLinearArena *frameArenas;
+    
+    VkFormat swapChainImageFormat; // shared by every window's swap chain
+    bool presentPolicyChanged; // recreate the swap chains with the new policy
+
+    VkRenderPass renderPass; // VK_NULL_HANDLE with dynamic rendering
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering;
+    PFN_vkCmdEndRenderingKHR cmdEndRendering;
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2; // NULL without VK_KHR_synchronization2
+    // Dynamic rendering: barriers around the scene pass come from the frame graph
+    RenderGraph frameGraph;
+    RenderGraphResource frameGraphTarget; // the window image, imported
+    ScenePass scenePass;
     VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
-
-    VkFramebuffer *swapChainFramebuffers;
+    VkPipeline graphicsPipeline; // default variant of pipelineCompiler
+    PipelineCompiler pipelineCompiler;
+    ExtendedDynamicState dynamicState;
+    PipelineVariantKey drawVariant; // state the draws are recorded with
+    VkShaderModule vertShaderModule;
+    VkShaderModule fragShaderModule;
+    VkPipelineCache pipelineCache;
+    bool pipelineCacheWarm; // pipelineCache was seeded from a valid file
+
+    // Read before the device exists, consumed by createGraphicsPipeline and createPipelineCache
+    shaderFile vertShaderFile;
+    shaderFile fragShaderFile;
+    shaderFile compShaderFile; // only with --animate
+    void *pipelineCacheData;
+    size_t pipelineCacheDataSize;
+
+    // Device-local geometry, filled once through a staging buffer
+    VkBuffer vertexBuffer;
+    GpuAllocation vertexAllocation;
+    VkBuffer indexBuffer;
+    GpuAllocation indexAllocation;
+    u32 indexCount;
+
+    // Per-instance transforms and colors, read in shader.vert by gl_InstanceIndex
+    VkBuffer instanceBuffer;
+    GpuAllocation instanceAllocation;
+    u32 instanceCount;
+
+    // Every buffer and image shaders read, bound once per command buffer
+    BindlessHeap descriptorHeap;
+    u32 instanceSlot;
+
+    // --animate: shader.comp writes a copy of the instances per frame in flight
+    // on computeQueue, the frame's graphics submit waits on computeTimeline
+    VkPipelineLayout computePipelineLayout;
+    VkPipeline computePipeline;
+    VkBuffer *animatedInstanceBuffers;
+    GpuAllocation *animatedInstanceAllocations;
+    u32 *animatedInstanceSlots;
+    VkCommandPool computeCommandPool;
+    VkCommandBuffer *computeCommandBuffers;
+    VkSemaphore computeTimeline;
+    double animationStart;
 
     VkCommandPool commandPool;
+    VkCommandPool transferCommandPool; // on transferFamily, only with a transferQueue
     VkCommandBuffer *commandBuffers;
     u32 commandBufferCount;
 
-    VkSemaphore *imageAvailableSemaphores;
+    WorkerPool workerPool;
+    RecordWorker *recordWorkers; // one per worker of workerPool, NULL when recording on one thread
+    WindowImage recordTarget; // target of the secondaries being recorded
+    u32 drawCount;
+
+    // One per frame in flight, signaled by the frame's submission for the present of all windows
     VkSemaphore *renderFinishedSemaphores;
-    VkFence *inFlightFences;
 
-    u32 imageAvailableSemaphoreCount;
-    u32 renderFinishedSemaphoreCount;
-    u32 inFlightFenceCount;
-    
-    
+    // Frame N signals value N on frameTimeline when its commands complete,
+    // so frame N can start once value N - framesInFlight has been reached.
+    VkSemaphore frameTimeline;
+    uint64_t frameTimelineValue; // value signaled by the last submitted frame
+
     u32 currentFrame;
-    bool framebufferResized;
-} App;
 
-typedef struct shaderFile{
-    size_t size;
-    char *code;
-} shaderFile;
+    // Frame timing: two GPU timestamps per recorded command buffer around the
+    // render pass, slots are indexed by frame in flight or by swap chain image
+    VkQueryPool timestampQueryPool;
+    bool timestampQueryPending[TIMESTAMP_QUERY_SLOTS];
+    bool gpuTimingSupported;
+    double timestampPeriodNs;
+    uint64_t timestampMask;
+
+    FrameStats stats;
+    FILE *statsFile;
+
+    FrameCapture capture; // capture.active once createCapture started the writer
+} App;
 
 /* functions prototype */
 
+void parseArgs(AppConfig *pConfig, int argc, char **argv);
+
+void initApp(App *pApp);
+void initGlfw(App *pApp);
 void initWindow(App *pApp);
-void initVulkan(App *pApp);
+
+void recordStartupPhase(App *pApp, const char *name, double start, u32 thread);
+
+void reportStartupPhases(App *pApp);
+
+void finishStartupTrace(App *pApp);
 void mainloop(App *pApp);
 void cleanup(App *pApp);
 
@@ -130,17 +512,56 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice device);
 
 SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface);
 
+void freeSwapChainSupportDetails(SwapChainSupportDetails *pDetails);
+
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(u32 formatCount, VkSurfaceFormatKHR *availableFormats);
 
-VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *availablePresentModes);
+VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *availablePresentModes,
+    PresentPolicy policy);
+
+bool parsePresentPolicy(const char *name, PresentPolicy *pPolicy);
+
+const char *presentModeName(VkPresentModeKHR presentMode);
 
 void createSwapChain(App *pApp);
 
+void createWindowSwapChain(App *pApp, AppWindow *pWindow);
+
+void createOffscreenImages(App *pApp, AppWindow *pWindow);
+
+void createAllocator(App *pApp);
+
 void createImageViews(App *pApp);
 
+void createWindowImageViews(App *pApp, AppWindow *pWindow);
+
 void createGraphicsPipeline(App *pApp);
 
-static shaderFile readFile(char *filename);
+static void *pipelineCompileThread(void *pArg);
+
+VkPipeline compilePipelineVariant(App *pApp, const PipelineVariantKey *pKey);
+
+VkPipeline findPipelineVariant(App *pApp, const PipelineVariantKey *pKey);
+
+bool recordVariantState(App *pApp, VkCommandBuffer commandBuffer, const PipelineVariantKey *pKey);
+
+void finishPipelineVariants(App *pApp);
+
+void destroyPipelineVariants(App *pApp);
+
+void loadPipelineCacheFile(App *pApp);
+
+void createPipelineCache(App *pApp);
+
+bool isPipelineCacheCompatible(const void *data, size_t size, const VkPhysicalDeviceProperties *pProperties);
+
+void savePipelineCache(App *pApp);
+
+shaderFile loadShader(App *pApp, const char *name);
+
+void loadShaders(App *pApp);
+
+void unloadShader(shaderFile *pShaderFile);
 
 VkShaderModule createShaderModule(shaderFile shaderFile, App *pApp);
 
@@ -148,21 +569,105 @@ void createRenderPass(App *pApp);
 
 void createFramebuffers(App *pApp);
 
+void createWindowFramebuffers(App *pApp, AppWindow *pWindow);
+
 void createCommandPool(App *pApp);
 
 void createCommandbuffers(App *pApp);
 
-void recordCommandBuffer(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex);
+void createSharedBuffer(App *pApp, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+    const u32 *queueFamilies, u32 queueFamilyCount, VkBuffer *pBuffer, GpuAllocation *pAllocation);
+
+void createBuffer(App *pApp, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+    GpuLinearArena *pArena, VkBuffer *pBuffer, GpuAllocation *pAllocation);
+
+void createGeometryBuffers(App *pApp);
+
+void uploadBuffers(App *pApp, const BufferUpload *uploads, u32 uploadCount);
+
+void createDescriptorHeap(App *pApp);
+
+void createInstanceBuffer(App *pApp, u32 instanceCount);
+
+void destroyInstanceBuffer(App *pApp);
+
+void createInstanceDescriptor(App *pApp);
+
+void writeInstanceDescriptor(App *pApp);
+
+void createComputePipeline(App *pApp);
+
+void createAnimation(App *pApp);
+
+void destroyAnimation(App *pApp);
+
+void submitAnimation(App *pApp, uint64_t frameValue);
+
+void setInstanceCount(App *pApp, u32 instanceCount);
+
+void recordCommandBuffer(App *pApp, VkCommandBuffer commandBuffer, const WindowImage *targets, u32 targetCount,
+    u32 querySlot, const VkCommandBuffer *secondaries, u32 secondaryCount);
+
+void recordDynamicRendering(App *pApp, VkCommandBuffer commandBuffer, WindowImage target, VkClearValue clearColor,
+    const VkCommandBuffer *secondaries, u32 secondaryCount);
+
+bool recordDrawState(App *pApp, const AppWindow *pWindow, VkCommandBuffer commandBuffer);
+
+void recordDraws(App *pApp, VkCommandBuffer commandBuffer, u32 firstDraw, u32 drawCount);
+
+void createRecordWorkers(App *pApp, u32 threadCount);
+
+void destroyRecordWorkers(App *pApp);
+
+void recordSecondaryCommandBuffers(App *pApp, WindowImage target);
+
+void createStaticCommandBuffers(App *pApp);
+
+void createWindowStaticCommandBuffers(App *pApp, AppWindow *pWindow);
+
+void freeStaticCommandBuffers(App *pApp);
+
+void freeWindowStaticCommandBuffers(App *pApp, AppWindow *pWindow);
 
 void drawFrame(App *pApp);
 
+void createTimestampQueries(App *pApp);
+
+void collectGpuTiming(App *pApp, u32 slot);
+
+void dumpFrameStats(App *pApp);
+
+void runHeadlessBenchmark(App *pApp);
+
+double benchmarkFrames(App *pApp, u32 frameCount);
+
+void runThreadSweep(App *pApp, u32 frameCount);
+
 void createSyncObjects(App *pApp);
 
-void recreateSwapChain(App *pApp);
+void createFrameGraph(App *pApp);
+
+void createCapture(App *pApp);
+
+CaptureSlot *recordCapture(App *pApp, WindowImage target, uint64_t frameValue);
 
-void cleanupSwapChain(App *pApp);
+void destroyCapture(App *pApp);
+
+void waitForFrameTimeline(App *pApp, uint64_t value);
+
+void recreateSwapChain(App *pApp, AppWindow *pWindow);
+
+void cleanupSwapChain(App *pApp, AppWindow *pWindow);
+
+void retireSwapChain(App *pApp, AppWindow *pWindow);
+
+void markRetiredSwapChainsReplaced(AppWindow *pWindow, uint64_t frameValue);
+
+void destroyRetiredSwapChains(App *pApp, AppWindow *pWindow, bool waitAll);
 
 static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
 
+static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+
 
 #endif
\ No newline at end of file
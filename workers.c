@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "workers.h"
+
+static void *workerMain(void *pArg){
+    WorkerThread *self = (WorkerThread *) pArg;
+    WorkerPool *pool = self->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for(;;){
+        while(!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        if(pool->quit)
+            break;
+        seen = pool->generation;
+
+        pthread_mutex_unlock(&pool->mutex);
+        pool->job(pool->pContext, self->index);
+        pthread_mutex_lock(&pool->mutex);
+
+        if(--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+void workerPoolCreate(WorkerPool *pPool, uint32_t workerCount){
+    *pPool = (WorkerPool) {
+        .workerCount = workerCount,
+    };
+
+    pthread_mutex_init(&pPool->mutex, NULL);
+    pthread_cond_init(&pPool->start, NULL);
+    pthread_cond_init(&pPool->done, NULL);
+
+    if(workerCount <= 1)
+        return;
+
+    pPool->threads = (WorkerThread *) calloc(workerCount - 1, sizeof(WorkerThread));
+    for(uint32_t i = 0; i < workerCount - 1; i++){
+        pPool->threads[i].pool = pPool;
+        pPool->threads[i].index = i + 1;
+        if(pthread_create(&pPool->threads[i].thread, NULL, workerMain, &pPool->threads[i]) != 0){
+            printf("failed to start worker thread!\n");
+            exit(1);
+        }
+    }
+}
+
+void workerPoolRun(WorkerPool *pPool, WorkerJob job, void *pContext){
+    if(pPool->workerCount > 1){
+        pthread_mutex_lock(&pPool->mutex);
+        pPool->job = job;
+        pPool->pContext = pContext;
+        pPool->pending = pPool->workerCount - 1;
+        pPool->generation++;
+        pthread_cond_broadcast(&pPool->start);
+        pthread_mutex_unlock(&pPool->mutex);
+    }
+
+    job(pContext, 0);
+
+    if(pPool->workerCount > 1){
+        pthread_mutex_lock(&pPool->mutex);
+        while(pPool->pending > 0)
+            pthread_cond_wait(&pPool->done, &pPool->mutex);
+        pthread_mutex_unlock(&pPool->mutex);
+    }
+}
+
+void workerPoolDestroy(WorkerPool *pPool){
+    pthread_mutex_lock(&pPool->mutex);
+    pPool->quit = true;
+    pthread_cond_broadcast(&pPool->start);
+    pthread_mutex_unlock(&pPool->mutex);
+
+    for(uint32_t i = 0; i + 1 < pPool->workerCount; i++){
+        pthread_join(pPool->threads[i].thread, NULL);
+    }
+    free(pPool->threads);
+
+    pthread_mutex_destroy(&pPool->mutex);
+    pthread_cond_destroy(&pPool->start);
+    pthread_cond_destroy(&pPool->done);
+}
@@ -0,0 +1,42 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Fork-join thread pool.
+ * workerPoolRun calls the job once per worker index and returns when all of
+ * them are done. Index 0 runs on the calling thread, so a pool of one worker
+ * starts no threads at all. */
+
+typedef void (*WorkerJob)(void *pContext, uint32_t workerIndex);
+
+typedef struct WorkerThread {
+    struct WorkerPool *pool;
+    uint32_t index;
+    pthread_t thread;
+} WorkerThread;
+
+typedef struct WorkerPool {
+    uint32_t workerCount; // including the calling thread
+    WorkerThread *threads; // workerCount - 1
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation; // bumped for every job
+    uint32_t pending;
+    bool quit;
+
+    WorkerJob job;
+    void *pContext;
+} WorkerPool;
+
+void workerPoolCreate(WorkerPool *pPool, uint32_t workerCount);
+
+void workerPoolRun(WorkerPool *pPool, WorkerJob job, void *pContext);
+
+void workerPoolDestroy(WorkerPool *pPool);
+
+#endif